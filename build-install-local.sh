@@ -14,11 +14,12 @@ export DEBIAN_FRONTEND=noninteractive
 sudo apt-get update
 sudo apt-get install -qq raspberrypi-kernel-headers
 
-# Build imx585 driver
+# Build imx585 driver and the STARVIS 2 core it depends on
 cd ./drivers/media/i2c
 make
-xz -f imx585.ko
+xz -f imx585.ko sony-starvis2.ko
 sudo cp imx585.ko.xz /usr/lib/modules/$(uname -r)/kernel/drivers/media/i2c/imx585.ko.xz
+sudo cp sony-starvis2.ko.xz /usr/lib/modules/$(uname -r)/kernel/drivers/media/i2c/sony-starvis2.ko.xz
 
 # Build Raspberry Pi 4 CSI-2 (bcm2835-unicam) driver
 cd ../../../drivers/media/platform/bcm2835
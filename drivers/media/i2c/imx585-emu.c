@@ -0,0 +1,366 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Emulated Sony IMX585 for running the imx585 driver without a sensor
+ *
+ * Registers an I2C adapter with a register file behind the sensor's address,
+ * a fixed 24 MHz xclk and an "imx585" client on the adapter, so that
+ * imx585.ko probes on any machine, e.g. an x86 VM. Like the sensor, the
+ * adapter takes a 16-bit big endian register address followed by
+ * auto-incrementing 8-bit data, and it answers the chip ID read at probe.
+ * Everything else written is stored and read back.
+ *
+ * A minimal V4L2 bridge binds the sensor subdev and exposes it as
+ * /dev/v4l-subdev*, so formats and controls can be set from userspace. The
+ * stream file in debugfs calls s_stream. The imx585-emu directory in debugfs
+ * counts the transfers seen on the bus, next to the driver's own counters
+ * under imx585-<dev>. Writing 0 to a counter clears it.
+ *
+ * The bus_khz parameter makes each transfer take as long as it would on a
+ * real I2C bus, so the measured stream start and control times include the
+ * bus cost of the transfers the driver issues.
+ *
+ * Copyright (C) 2024 OCTOPUS CINEMA
+ */
+#include <asm/unaligned.h>
+#include <linux/clk-provider.h>
+#include <linux/clkdev.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <media/v4l2-async.h>
+#include <media/v4l2-device.h>
+#include <media/v4l2-subdev.h>
+
+#define IMX585_EMU_ADDR			0x1a
+#define IMX585_EMU_XCLK_FREQ		24000000
+
+/* Read by imx585_identify_module() */
+#define IMX585_EMU_REG_CHIP_ID		0x30dc
+#define IMX585_EMU_CHIP_ID		0x32
+
+/* Clock cycles per byte on the bus, eight data bits and the acknowledge */
+#define IMX585_EMU_BITS_PER_BYTE	9
+
+static unsigned int bus_khz;
+module_param(bus_khz, uint, 0644);
+MODULE_PARM_DESC(bus_khz, "Emulated I2C bus clock in kHz, 0 transfers instantly (default)");
+
+struct imx585_emu_stats {
+	u64 transfers;
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+	u64 stream_on_us;
+	u64 stream_off_us;
+};
+
+struct imx585_emu {
+	struct i2c_adapter adap;
+	/* One byte per register address, the pointer wraps like the sensor's */
+	u8 regs[SZ_64K];
+	u16 ptr;
+
+	struct clk_hw *xclk;
+	struct clk_lookup *xclk_lookup;
+	struct i2c_client *client;
+
+	struct v4l2_device v4l2_dev;
+	struct v4l2_async_notifier notifier;
+	struct v4l2_subdev *sd;
+	bool streaming;
+
+	struct imx585_emu_stats stats;
+	struct dentry *debugfs;
+};
+
+static struct imx585_emu *imx585_emu;
+
+/* Gives the sensor an fwnode to parse, without any properties */
+static const struct software_node imx585_emu_swnode = {
+	.name = "imx585-emu-sensor",
+};
+
+/* Start condition, address byte and data, at the emulated bus clock */
+static void imx585_emu_bus_delay(unsigned int len)
+{
+	unsigned int khz = READ_ONCE(bus_khz);
+
+	if (khz)
+		fsleep(DIV_ROUND_UP(IMX585_EMU_BITS_PER_BYTE * (len + 1) * 1000,
+				    khz));
+}
+
+/* Transfers are serialised by the adapter lock */
+static int imx585_emu_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
+			   int num)
+{
+	struct imx585_emu *emu = i2c_get_adapdata(adap);
+	int i, j;
+
+	emu->stats.transfers++;
+
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *msg = &msgs[i];
+
+		if (msg->addr != IMX585_EMU_ADDR)
+			return -ENXIO;
+
+		if (msg->flags & I2C_M_RD) {
+			for (j = 0; j < msg->len; j++)
+				msg->buf[j] = emu->regs[emu->ptr++];
+			emu->stats.reads++;
+		} else {
+			if (msg->len < 2)
+				return -EIO;
+
+			emu->ptr = get_unaligned_be16(msg->buf);
+			for (j = 2; j < msg->len; j++)
+				emu->regs[emu->ptr++] = msg->buf[j];
+			if (msg->len > 2)
+				emu->stats.writes++;
+
+			/* The chip ID is read only */
+			emu->regs[IMX585_EMU_REG_CHIP_ID] = IMX585_EMU_CHIP_ID;
+		}
+
+		emu->stats.bytes += msg->len;
+		imx585_emu_bus_delay(msg->len);
+	}
+
+	return num;
+}
+
+static u32 imx585_emu_func(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm imx585_emu_algo = {
+	.master_xfer = imx585_emu_xfer,
+	.functionality = imx585_emu_func,
+};
+
+static int imx585_emu_bound(struct v4l2_async_notifier *notifier,
+			    struct v4l2_subdev *sd,
+			    struct v4l2_async_subdev *asd)
+{
+	struct imx585_emu *emu = container_of(notifier, struct imx585_emu,
+					      notifier);
+
+	emu->sd = sd;
+
+	return 0;
+}
+
+static void imx585_emu_unbind(struct v4l2_async_notifier *notifier,
+			      struct v4l2_subdev *sd,
+			      struct v4l2_async_subdev *asd)
+{
+	struct imx585_emu *emu = container_of(notifier, struct imx585_emu,
+					      notifier);
+
+	emu->sd = NULL;
+	emu->streaming = false;
+}
+
+static int imx585_emu_complete(struct v4l2_async_notifier *notifier)
+{
+	return v4l2_device_register_subdev_nodes(notifier->v4l2_dev);
+}
+
+static const struct v4l2_async_notifier_operations imx585_emu_notify_ops = {
+	.bound = imx585_emu_bound,
+	.unbind = imx585_emu_unbind,
+	.complete = imx585_emu_complete,
+};
+
+static int imx585_emu_stream_get(void *data, u64 *val)
+{
+	struct imx585_emu *emu = data;
+
+	*val = emu->streaming;
+
+	return 0;
+}
+
+static int imx585_emu_stream_set(void *data, u64 val)
+{
+	struct imx585_emu *emu = data;
+	ktime_t start;
+	int ret;
+
+	if (!emu->sd)
+		return -ENODEV;
+
+	start = ktime_get();
+	ret = v4l2_subdev_call(emu->sd, video, s_stream, !!val);
+	if (ret)
+		return ret;
+
+	if (val)
+		emu->stats.stream_on_us = ktime_us_delta(ktime_get(), start);
+	else
+		emu->stats.stream_off_us = ktime_us_delta(ktime_get(), start);
+	emu->streaming = !!val;
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(imx585_emu_stream_fops, imx585_emu_stream_get,
+			 imx585_emu_stream_set, "%llu\n");
+
+static void imx585_emu_debugfs_init(struct imx585_emu *emu)
+{
+	struct imx585_emu_stats *stats = &emu->stats;
+
+	emu->debugfs = debugfs_create_dir("imx585-emu", NULL);
+
+	debugfs_create_file_unsafe("stream", 0644, emu->debugfs, emu,
+				   &imx585_emu_stream_fops);
+	debugfs_create_u64("transfers", 0644, emu->debugfs, &stats->transfers);
+	debugfs_create_u64("reads", 0644, emu->debugfs, &stats->reads);
+	debugfs_create_u64("writes", 0644, emu->debugfs, &stats->writes);
+	debugfs_create_u64("bytes", 0644, emu->debugfs, &stats->bytes);
+	debugfs_create_u64("stream_on_us", 0644, emu->debugfs,
+			   &stats->stream_on_us);
+	debugfs_create_u64("stream_off_us", 0644, emu->debugfs,
+			   &stats->stream_off_us);
+}
+
+static int imx585_emu_register_bridge(struct imx585_emu *emu)
+{
+	struct v4l2_async_subdev *asd;
+	int ret;
+
+	strscpy(emu->v4l2_dev.name, "imx585-emu", sizeof(emu->v4l2_dev.name));
+	ret = v4l2_device_register(NULL, &emu->v4l2_dev);
+	if (ret)
+		return ret;
+
+	v4l2_async_nf_init(&emu->notifier);
+	asd = v4l2_async_nf_add_i2c(&emu->notifier,
+				    i2c_adapter_id(&emu->adap),
+				    IMX585_EMU_ADDR, struct v4l2_async_subdev);
+	if (IS_ERR(asd)) {
+		ret = PTR_ERR(asd);
+		goto err_cleanup;
+	}
+
+	emu->notifier.ops = &imx585_emu_notify_ops;
+	ret = v4l2_async_nf_register(&emu->v4l2_dev, &emu->notifier);
+	if (ret)
+		goto err_cleanup;
+
+	return 0;
+
+err_cleanup:
+	v4l2_async_nf_cleanup(&emu->notifier);
+	v4l2_device_unregister(&emu->v4l2_dev);
+	return ret;
+}
+
+static void imx585_emu_unregister_bridge(struct imx585_emu *emu)
+{
+	v4l2_async_nf_unregister(&emu->notifier);
+	v4l2_async_nf_cleanup(&emu->notifier);
+	v4l2_device_unregister(&emu->v4l2_dev);
+}
+
+static int __init imx585_emu_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("imx585", IMX585_EMU_ADDR),
+		.swnode = &imx585_emu_swnode,
+	};
+	struct imx585_emu *emu;
+	int ret;
+
+	emu = kvzalloc(sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	emu->regs[IMX585_EMU_REG_CHIP_ID] = IMX585_EMU_CHIP_ID;
+
+	emu->adap.owner = THIS_MODULE;
+	emu->adap.algo = &imx585_emu_algo;
+	strscpy(emu->adap.name, "imx585-emu", sizeof(emu->adap.name));
+	i2c_set_adapdata(&emu->adap, emu);
+
+	ret = i2c_add_adapter(&emu->adap);
+	if (ret)
+		goto err_free;
+
+	/* The sensor looks its xclk up by the name of the client device */
+	emu->xclk = clk_hw_register_fixed_rate(NULL, "imx585-emu-xclk", NULL, 0,
+					       IMX585_EMU_XCLK_FREQ);
+	if (IS_ERR(emu->xclk)) {
+		ret = PTR_ERR(emu->xclk);
+		goto err_del_adapter;
+	}
+
+	emu->xclk_lookup = clkdev_hw_create(emu->xclk, NULL, "%d-%04x",
+					    i2c_adapter_id(&emu->adap),
+					    IMX585_EMU_ADDR);
+	if (!emu->xclk_lookup) {
+		ret = -ENOMEM;
+		goto err_unregister_clk;
+	}
+
+	ret = imx585_emu_register_bridge(emu);
+	if (ret)
+		goto err_drop_lookup;
+
+	imx585_emu_debugfs_init(emu);
+
+	/* Probes right away if imx585.ko is loaded, otherwise once it is */
+	emu->client = i2c_new_client_device(&emu->adap, &info);
+	if (IS_ERR(emu->client)) {
+		ret = PTR_ERR(emu->client);
+		goto err_debugfs;
+	}
+
+	imx585_emu = emu;
+
+	return 0;
+
+err_debugfs:
+	debugfs_remove_recursive(emu->debugfs);
+	imx585_emu_unregister_bridge(emu);
+err_drop_lookup:
+	clkdev_drop(emu->xclk_lookup);
+err_unregister_clk:
+	clk_hw_unregister_fixed_rate(emu->xclk);
+err_del_adapter:
+	i2c_del_adapter(&emu->adap);
+err_free:
+	kvfree(emu);
+	return ret;
+}
+
+static void __exit imx585_emu_exit(void)
+{
+	struct imx585_emu *emu = imx585_emu;
+
+	debugfs_remove_recursive(emu->debugfs);
+
+	if (emu->sd && emu->streaming)
+		v4l2_subdev_call(emu->sd, video, s_stream, 0);
+
+	i2c_unregister_device(emu->client);
+	imx585_emu_unregister_bridge(emu);
+	clkdev_drop(emu->xclk_lookup);
+	clk_hw_unregister_fixed_rate(emu->xclk);
+	i2c_del_adapter(&emu->adap);
+	kvfree(emu);
+}
+
+module_init(imx585_emu_init);
+module_exit(imx585_emu_exit);
+
+MODULE_AUTHOR("Russell Newman <russellnewman@octopuscinema.com>");
+MODULE_DESCRIPTION("Emulated Sony IMX585 on a virtual I2C adapter");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the Sony IMX585 timing math
+ *
+ * The helpers and mode tables are static, so this file is built into
+ * imx585.c when CONFIG_VIDEO_IMX585_KUNIT_TEST is set rather than being
+ * linked separately. Build with
+ *
+ *   make CONFIG_VIDEO_IMX585_KUNIT_TEST=y
+ *
+ * against a kernel with KUnit enabled. The suite runs when imx585.ko is
+ * loaded and reports through the kernel log.
+ *
+ * Copyright (C) 2024 OCTOPUS CINEMA
+ */
+#include <kunit/test.h>
+
+/* Calls timed by the benchmark cases, long enough to average out ktime_get() */
+#define IMX585_TEST_BENCH_LOOPS		1000000
+
+/* Values checked between the ends of a range, see imx585_test_next() */
+#define IMX585_TEST_SAMPLES		512
+
+static const struct {
+	const struct imx585_mode *modes;
+	unsigned int num_modes;
+} imx585_test_mode_tables[] = {
+	{ supported_modes_12bit, ARRAY_SIZE(supported_modes_12bit) },
+	{ supported_modes_nonlinear_12bit, ARRAY_SIZE(supported_modes_nonlinear_12bit) },
+	{ supported_modes_16bit, ARRAY_SIZE(supported_modes_16bit) },
+};
+
+#define for_each_imx585_test_mode(t, m)						\
+	for (t = 0; t < ARRAY_SIZE(imx585_test_mode_tables); t++)		\
+		for (m = imx585_test_mode_tables[t].modes;			\
+		     m < imx585_test_mode_tables[t].modes +			\
+			 imx585_test_mode_tables[t].num_modes; m++)
+
+/*
+ * Walk [min, max] through both ends, the values next to them and about
+ * IMX585_TEST_SAMPLES points in between. The stride is odd so the samples
+ * do not all share one alignment. Use as
+ *
+ *   for (x = min; ; x = imx585_test_next(x, min, max)) {
+ *           ...
+ *           if (x == max)
+ *                   break;
+ *   }
+ */
+static u32 imx585_test_next(u32 x, u32 min, u32 max)
+{
+	u32 step = ((max - min) / IMX585_TEST_SAMPLES) | 1;
+
+	if (x < min + 2 || x >= max - 2)
+		return x + 1;
+	if (max - 2 - x <= step)
+		return max - 2;
+	return x + step;
+}
+
+/* SHR is a 16-bit register and must stay 4 lines short of the frame */
+static u32 imx585_test_max_shr(u32 vmax)
+{
+	return min_t(u32, vmax - 4, 0xffff);
+}
+
+/*
+ * Exposures the VBLANK handler allows must map to an SHR inside the sensor
+ * limits and back to the same number of lines.
+ */
+static void imx585_test_exposure_sweep(struct kunit *test,
+				       const struct imx585_mode *mode,
+				       u32 hmax, u32 vmax)
+{
+	u32 min_exposure, max_exposure, exposure;
+
+	calculate_min_max_v4l2_cid_exposure(hmax, vmax, mode->min_SHR, 0,
+					    IMX585_SHR_OFFSET,
+					    &min_exposure, &max_exposure);
+	KUNIT_ASSERT_LE(test, min_exposure, max_exposure);
+
+	for (exposure = min_exposure; ;
+	     exposure = imx585_test_next(exposure, min_exposure, max_exposure)) {
+		u32 shr = calculate_shr(exposure, hmax, vmax, 0,
+					IMX585_SHR_OFFSET);
+
+		KUNIT_ASSERT_GE_MSG(test, shr, (u32)mode->min_SHR,
+				    "%ux%u HMAX %u VMAX %u exposure %u",
+				    mode->width, mode->height, hmax, vmax,
+				    exposure);
+		KUNIT_ASSERT_LE_MSG(test, shr, imx585_test_max_shr(vmax),
+				    "%ux%u HMAX %u VMAX %u exposure %u",
+				    mode->width, mode->height, hmax, vmax,
+				    exposure);
+		KUNIT_ASSERT_EQ_MSG(test,
+				    calculate_v4l2_cid_exposure(hmax, vmax, shr, 0,
+								IMX585_SHR_OFFSET),
+				    exposure,
+				    "%ux%u HMAX %u VMAX %u SHR %u",
+				    mode->width, mode->height, hmax, vmax, shr);
+
+		if (exposure == max_exposure)
+			break;
+	}
+}
+
+static void imx585_test_exposure_round_trip(struct kunit *test)
+{
+	const struct imx585_mode *mode;
+	unsigned int t;
+
+	for_each_imx585_test_mode(t, mode) {
+		/* Defaults, both ends of the range and around the SHR cap */
+		const u32 vmax[] = {
+			mode->min_VMAX, mode->min_VMAX + 1, mode->default_VMAX,
+			0xffff + 3, 0xffff + 4, 0xffff + 5, IMX585_VMAX_MAX,
+		};
+		const u32 hmax[] = {
+			mode->min_HMAX, mode->default_HMAX, IMX585_HMAX_MAX,
+		};
+		unsigned int h, v;
+
+		for (h = 0; h < ARRAY_SIZE(hmax); h++)
+			for (v = 0; v < ARRAY_SIZE(vmax); v++)
+				imx585_test_exposure_sweep(test, mode, hmax[h],
+							   vmax[v]);
+	}
+}
+
+/* Both ends of the exposure range must hit the SHR limits */
+static void imx585_test_exposure_limits_vmax(struct kunit *test,
+					     const struct imx585_mode *mode,
+					     u32 vmax)
+{
+	u32 hmax = mode->default_HMAX;
+	u32 min_exposure, max_exposure;
+
+	calculate_min_max_v4l2_cid_exposure(hmax, vmax, mode->min_SHR, 0,
+					    IMX585_SHR_OFFSET, &min_exposure,
+					    &max_exposure);
+
+	KUNIT_ASSERT_EQ_MSG(test,
+			    calculate_shr(min_exposure, hmax, vmax, 0,
+					  IMX585_SHR_OFFSET),
+			    imx585_test_max_shr(vmax),
+			    "%ux%u VMAX %u", mode->width, mode->height, vmax);
+	KUNIT_ASSERT_EQ_MSG(test,
+			    calculate_shr(max_exposure, hmax, vmax, 0,
+					  IMX585_SHR_OFFSET),
+			    (u32)mode->min_SHR,
+			    "%ux%u VMAX %u", mode->width, mode->height, vmax);
+}
+
+static void imx585_test_exposure_limits(struct kunit *test)
+{
+	const struct imx585_mode *mode;
+	unsigned int t, v;
+
+	for_each_imx585_test_mode(t, mode) {
+		/* Where the SHR cap takes over from the frame length */
+		const u32 cap[] = { 0xffff + 3, 0xffff + 4, 0xffff + 5 };
+		u32 vmax;
+
+		for (v = 0; v < ARRAY_SIZE(cap); v++)
+			imx585_test_exposure_limits_vmax(test, mode, cap[v]);
+
+		for (vmax = mode->min_VMAX; ;
+		     vmax = imx585_test_next(vmax, mode->min_VMAX,
+					     IMX585_VMAX_MAX)) {
+			imx585_test_exposure_limits_vmax(test, mode, vmax);
+			if (vmax == IMX585_VMAX_MAX)
+				break;
+		}
+	}
+}
+
+/*
+ * imx585_set_ctrl() derives HMAX from the HBLANK control and
+ * imx585_set_framing_limits() derives the default HBLANK from HMAX. HMAX
+ * values the HBLANK range can express must survive the round trip.
+ */
+static void imx585_test_hblank_to_hmax(struct kunit *test)
+{
+	const struct imx585_mode *mode;
+	unsigned int t;
+
+	for_each_imx585_test_mode(t, mode) {
+		u32 hmax_limit = min_t(u32, IMX585_HMAX_MAX,
+				       imx585_hblank_to_hmax(mode, IMX585_HMAX_MAX));
+		u32 hmax, hblank, prev = 0;
+
+		KUNIT_EXPECT_EQ(test, imx585_hmax_to_hblank(mode, mode->min_HMAX), 0U);
+		KUNIT_EXPECT_EQ(test, imx585_hblank_to_hmax(mode, 0), (u32)mode->min_HMAX);
+
+		for (hmax = mode->min_HMAX; ;
+		     hmax = imx585_test_next(hmax, mode->min_HMAX, hmax_limit)) {
+			hblank = imx585_hmax_to_hblank(mode, hmax);
+
+			KUNIT_ASSERT_LE_MSG(test, hblank, (u32)IMX585_HMAX_MAX,
+					    "%ux%u HMAX %u", mode->width,
+					    mode->height, hmax);
+			KUNIT_ASSERT_EQ_MSG(test, imx585_hblank_to_hmax(mode, hblank),
+					    hmax, "%ux%u HBLANK %u", mode->width,
+					    mode->height, hblank);
+
+			if (hmax == hmax_limit)
+				break;
+		}
+
+		/* Widening HBLANK never shortens the line */
+		for (hblank = 0; ;
+		     hblank = imx585_test_next(hblank, 0, IMX585_HMAX_MAX)) {
+			hmax = imx585_hblank_to_hmax(mode, hblank);
+
+			KUNIT_ASSERT_GE_MSG(test, hmax, prev, "%ux%u HBLANK %u",
+					    mode->width, mode->height, hblank);
+			prev = hmax;
+
+			if (hblank == IMX585_HMAX_MAX)
+				break;
+		}
+	}
+}
+
+static void imx585_test_bench_exposure(struct kunit *test)
+{
+	const struct imx585_mode *mode = &supported_modes_12bit[0];
+	u32 hmax = mode->default_HMAX;
+	u32 vmax = mode->default_VMAX;
+	u64 sum = 0, expected = 0;
+	ktime_t start;
+	u32 i;
+
+	start = ktime_get();
+	for (i = 0; i < IMX585_TEST_BENCH_LOOPS; i++) {
+		u32 exposure = 4 + i % (vmax - mode->min_SHR - 4);
+		u32 shr;
+
+		/* Keep the compiler from folding the loop into a formula */
+		OPTIMIZER_HIDE_VAR(exposure);
+		shr = calculate_shr(exposure, hmax, vmax, 0, IMX585_SHR_OFFSET);
+		OPTIMIZER_HIDE_VAR(shr);
+		sum += calculate_v4l2_cid_exposure(hmax, vmax, shr, 0,
+						   IMX585_SHR_OFFSET);
+		expected += exposure;
+	}
+
+	kunit_info(test, "exposure -> SHR -> exposure: %llu ps per call\n",
+		   div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)) * 1000,
+			   IMX585_TEST_BENCH_LOOPS));
+	KUNIT_EXPECT_EQ(test, sum, expected);
+}
+
+static void imx585_test_bench_hblank(struct kunit *test)
+{
+	const struct imx585_mode *mode = &supported_modes_12bit[0];
+	u64 sum = 0;
+	ktime_t start;
+	u32 i;
+
+	start = ktime_get();
+	for (i = 0; i < IMX585_TEST_BENCH_LOOPS; i++) {
+		u32 hblank = i % IMX585_HMAX_MAX;
+
+		OPTIMIZER_HIDE_VAR(hblank);
+		sum += imx585_hblank_to_hmax(mode, hblank);
+	}
+
+	kunit_info(test, "HBLANK -> HMAX: %llu ps per call\n",
+		   div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)) * 1000,
+			   IMX585_TEST_BENCH_LOOPS));
+	KUNIT_EXPECT_GE(test, sum, (u64)mode->min_HMAX * IMX585_TEST_BENCH_LOOPS);
+}
+
+static struct kunit_case imx585_timing_test_cases[] = {
+	KUNIT_CASE(imx585_test_exposure_round_trip),
+	KUNIT_CASE(imx585_test_exposure_limits),
+	KUNIT_CASE(imx585_test_hblank_to_hmax),
+	KUNIT_CASE(imx585_test_bench_exposure),
+	KUNIT_CASE(imx585_test_bench_hblank),
+	{}
+};
+
+static struct kunit_suite imx585_timing_test_suite = {
+	.name = "imx585-timing",
+	.test_cases = imx585_timing_test_cases,
+};
+
+kunit_test_suite(imx585_timing_test_suite);
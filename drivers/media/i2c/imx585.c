@@ -9,11 +9,12 @@
  * Modified by OCTOPUSCINEMA
  * Copyright (C) 2024 OCTOPUS CINEMA
  */
-#include <asm/unaligned.h>
 #include <linux/clk.h>
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/pm_runtime.h>
@@ -24,6 +25,8 @@
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
 
+#include "sony-starvis2.h"
+
 // Support for rpi kernel pre git commit 314a685
 #ifndef MEDIA_BUS_FMT_SENSOR_DATA
 #define MEDIA_BUS_FMT_SENSOR_DATA 		0x7002
@@ -120,14 +123,9 @@ enum v4l2_xfer_func_sony {
 #define IMX585_PIXEL_ARRAY_WIDTH	3840U
 #define IMX585_PIXEL_ARRAY_HEIGHT	2160U
 
-struct imx585_reg {
-	u16 address;
-	u8 val;
-};
-
 struct IMX585_reg_list {
 	unsigned int num_of_regs;
-	const struct imx585_reg *regs;
+	const struct starvis2_reg *regs;
 };
 
 /* Mode : resolution and related config&values */
@@ -167,7 +165,7 @@ struct imx585_mode {
 };
 
 /* Common Modes */
-static const struct imx585_reg mode_common_regs[] = {
+static const struct starvis2_reg mode_common_regs[] = {
     {0x3002, 0x01},
     {0x301A, 0x00}, //WDMODE Normal mode
     //{0x301A, 0x10}, //WDMODE Clear HDR
@@ -435,7 +433,7 @@ static const struct imx585_reg mode_common_regs[] = {
 };
 
 /* All pixel 4K50. 12-bit (Normal) */
-static const struct imx585_reg mode_4k_regs[] = {
+static const struct starvis2_reg mode_4k_regs[] = {
 	{0x301A, 0x00}, // WDMODE Normal mode
 	{0x301B, 0x00}, // ADDMODE non-binning
 	{0x3022, 0x02}, // ADBIT 12-bit
@@ -458,7 +456,7 @@ static const struct imx585_reg mode_4k_regs[] = {
 };
 
 /* 2x2 binned 1080p60. 12-bit (Normal) */
-static const struct imx585_reg mode_1080_regs[] = {
+static const struct starvis2_reg mode_1080_regs[] = {
 	{0x301A, 0x00}, // WDMODE Normal mode
 	{0x301B, 0x01}, // ADDMODE binning
 	{0x3022, 0x00}, // ADBIT 10-bit
@@ -481,7 +479,7 @@ static const struct imx585_reg mode_1080_regs[] = {
 };
 
 /* All pixel 4K30. 12-bit (HDR gradation compression) */
-static const struct imx585_reg mode_4k_nonlinear_regs[] = {
+static const struct starvis2_reg mode_4k_nonlinear_regs[] = {
     {0x301A, 0x10}, // WDMODE Clear HDR
     {0x301B, 0x00}, // ADDMODE Non-binning
 	
@@ -513,7 +511,7 @@ static const struct imx585_reg mode_4k_nonlinear_regs[] = {
 };
 
 /* All pixel 4K30. 16-bit (Clear HDR) */
-static const struct imx585_reg mode_4k_16bit_regs[] = {
+static const struct starvis2_reg mode_4k_16bit_regs[] = {
     {0x301A, 0x10}, // WDMODE Clear HDR
     {0x301B, 0x00}, // ADDMODE Non-binning
 	
@@ -545,7 +543,7 @@ static const struct imx585_reg mode_4k_16bit_regs[] = {
 };
 
 /* 2x2 binned 1080p30. 16-bit (Clear HDR) */
-static const struct imx585_reg mode_1080_16bit_regs[] = {
+static const struct starvis2_reg mode_1080_16bit_regs[] = {
     {0x301A, 0x10}, // WDMODE Clear HDR
     {0x301B, 0x01}, // ADDMODE Binning
 	
@@ -796,6 +794,9 @@ struct imx585 {
 
 	/* Any extra information related to different compatible sensors */
 	const struct imx585_compatible_data *compatible_data;
+
+	/* Register engine and counters shared with the other STARVIS 2 parts */
+	struct starvis2 core;
 };
 
 static inline struct imx585 *to_imx585(struct v4l2_subdev *_sd)
@@ -835,116 +836,6 @@ static inline void get_mode_table(unsigned int code, enum v4l2_xfer_func transfe
 	}
 }
 
-/* Read registers up to 2 at a time */
-static int imx585_read_reg(struct imx585 *imx585, u16 reg, u32 len, u32 *val)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
-	struct i2c_msg msgs[2];
-	u8 addr_buf[2] = { reg >> 8, reg & 0xff };
-	u8 data_buf[4] = { 0, };
-	int ret;
-
-	if (len > 4)
-		return -EINVAL;
-
-	/* Write register address */
-	msgs[0].addr = client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = ARRAY_SIZE(addr_buf);
-	msgs[0].buf = addr_buf;
-
-	/* Read data from register */
-	msgs[1].addr = client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = len;
-	msgs[1].buf = &data_buf[4 - len];
-
-	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
-
-	*val = get_unaligned_be32(data_buf);
-
-	return 0;
-}
-
-/* Write registers 1 byte at a time */
-static int imx585_write_reg_1byte(struct imx585 *imx585, u16 reg, u8 val)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
-	u8 buf[3];
-	int ret;
-
-	put_unaligned_be16(reg, buf);
-	buf[2] = val;
-	ret = i2c_master_send(client, buf, 3);
-	if ( ret != 3 )
-		return ret;
-
-	return 0;
-}
-
-/* Write registers 2 byte at a time */
-static int imx585_write_reg_2byte(struct imx585 *imx585, u16 reg, u16 val)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
-	u8 buf[4];
-	int ret;
-
-	put_unaligned_be16(reg, buf);
-	buf[2] = val;
-	buf[3] = val>>8;
-	ret = i2c_master_send(client, buf, 4);
-	if ( ret != 4 )
-		return ret;
-
-	return 0;
-}
-
-/* Write registers 3 byte at a time */
-static int imx585_write_reg_3byte(struct imx585 *imx585, u16 reg, u32 val)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
-	u8 buf[5];
-
-	put_unaligned_be16(reg, buf);
-	buf[2]  = val;
-	buf[3]  = val>>8;
-	buf[4]  = val>>16;
-	if (i2c_master_send(client, buf, 5) != 5)
-		return -EIO;
-
-	return 0;
-}
-
-/* Write a list of 1 byte registers */
-static int imx585_write_regs(struct imx585 *imx585,
-			     const struct imx585_reg *regs, u32 len)
-{
-	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
-	unsigned int i;
-	int ret;
-
-	for (i = 0; i < len; i++) {
-		ret = imx585_write_reg_1byte(imx585, regs[i].address, regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-						"Failed to write reg 0x%4.4x. error = %d\n",
-						regs[i].address, ret);
-
-			return ret;
-		}
-	}
-
-	return 0;
-}
-
-/* Hold register values until hold is disabled */
-static inline void imx585_register_hold(struct imx585 *imx585, bool hold)
-{
-	imx585_write_reg_1byte(imx585, 0x3001, hold ? 1 : 0);
-}
-
 /* Get bayer order based on flip setting. */
 static u32 imx585_get_format_code(struct imx585 *imx585, u32 code)
 {
@@ -1000,41 +891,122 @@ static int imx585_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 }
 
 
-static u64 calculate_v4l2_cid_exposure(u64 hmax, u64 vmax, u64 shr, u64 svr, u64 offset) {
-    u64 numerator;
-    numerator = (vmax * (svr + 1) - shr) * hmax + offset;
+/*
+Integration Time [s] = [{VMAX × (SVR + 1) – (SHR)}
+ × HMAX + offset] / (72 × 10^6)
+
+Integration Time [s] = exposure * HMAX / (72 × 10^6)
+
+Dividing through by HMAX, the exposure in lines is
+	exposure = VMAX × (SVR + 1) – SHR + offset / HMAX
+so neither direction needs a 64-bit division. These run for every AE
+update, keep them free of side effects and logging.
+*/
+#define IMX585_SHR_OFFSET				209
 
-    do_div(numerator, hmax);
-    numerator = clamp_t(uint32_t, numerator, 0, 0xFFFFFFFF);
-    return numerator;
+static inline u32 calculate_v4l2_cid_exposure(u32 hmax, u32 vmax, u32 shr, u32 svr, u32 offset)
+{
+	return vmax * (svr + 1) - shr + offset / hmax;
 }
 
-static void calculate_min_max_v4l2_cid_exposure(u64 hmax, u64 vmax, u64 min_shr, u64 svr, u64 offset, u64 *min_exposure, u64 *max_exposure) {
-    u64 max_shr = (svr + 1) * vmax - 4;
-    max_shr = min_t(uint64_t, max_shr, 0xFFFF);
+static inline void calculate_min_max_v4l2_cid_exposure(u32 hmax, u32 vmax, u32 min_shr, u32 svr, u32 offset, u32 *min_exposure, u32 *max_exposure)
+{
+	u32 max_shr = min_t(u32, (svr + 1) * vmax - 4, 0xFFFF);
 
-    *min_exposure = calculate_v4l2_cid_exposure(hmax, vmax, max_shr, svr, offset);
-    *max_exposure = calculate_v4l2_cid_exposure(hmax, vmax, min_shr, svr, offset);
+	*min_exposure = calculate_v4l2_cid_exposure(hmax, vmax, max_shr, svr, offset);
+	*max_exposure = calculate_v4l2_cid_exposure(hmax, vmax, min_shr, svr, offset);
 }
 
+/*
+ * Inverse of calculate_v4l2_cid_exposure(): exposure -> SHR -> exposure
+ * returns the same number of lines for any SHR in range.
+ */
+static inline u32 calculate_shr(u32 exposure, u32 hmax, u32 vmax, u32 svr, u32 offset)
+{
+	return vmax * (svr + 1) - exposure + offset / hmax;
+}
 
 /*
-Integration Time [s] = [{VMAX × (SVR + 1) – (SHR)}
- × HMAX + offset] / (72 × 10^6)
+ * HMAX and VMAX count periods of the 74.25 MHz internal clock, so one frame
+ * lasts HMAX * VMAX / IMX585_PIXEL_RATE seconds. The PIXEL_RATE control is
+ * scaled so that width + HBLANK pixels take exactly one HMAX period at the
+ * mode's minimum line length.
+ */
+static u64 imx585_mode_pixel_rate(const struct imx585_mode *mode)
+{
+	u64 pixel_rate = (u64)mode->width * IMX585_PIXEL_RATE;
 
-Integration Time [s] = exposure * HMAX / (72 × 10^6)
-*/
+	do_div(pixel_rate, mode->min_HMAX);
+	return pixel_rate;
+}
 
-static uint32_t calculate_shr(uint32_t exposure, uint32_t hmax, uint64_t vmax, uint32_t svr, uint32_t offset)
+static u32 imx585_hblank_to_hmax(const struct imx585_mode *mode, u32 hblank)
 {
-    uint64_t temp;
-    uint32_t shr;
+	u64 hmax = (u64)(mode->width + hblank) * IMX585_PIXEL_RATE;
 
-    temp = ((uint64_t)exposure * hmax - offset);
-    do_div(temp, hmax);
-    shr = (uint32_t)(vmax * (svr + 1) - temp);
+	do_div(hmax, (u32)imx585_mode_pixel_rate(mode));
+	return hmax;
+}
 
-    return shr;
+/* Rounds up so that imx585_hblank_to_hmax() gives back the same HMAX */
+static u32 imx585_hmax_to_hblank(const struct imx585_mode *mode, u32 hmax)
+{
+	u64 line = (u64)hmax * imx585_mode_pixel_rate(mode);
+
+	return DIV_ROUND_UP_ULL(line, IMX585_PIXEL_RATE) - mode->width;
+}
+
+/*
+ * Find the HMAX/VMAX pair whose frame period is closest to the requested
+ * interval. VMAX is solved for every candidate HMAX, starting from the mode
+ * minimum, and the search stops at the first exact match so that HMAX is only
+ * stretched when VMAX alone cannot hit the target (e.g. 29.97 fps).
+ */
+static void imx585_solve_frame_timing(const struct imx585_mode *mode,
+				      const struct v4l2_fract *interval,
+				      u32 *best_hmax, u32 *best_vmax)
+{
+	u64 target, best_err = U64_MAX;
+	u32 hmax, hmax_limit;
+
+	*best_hmax = mode->min_HMAX;
+	*best_vmax = mode->min_VMAX;
+
+	if (!interval->numerator || !interval->denominator)
+		return;
+
+	/* Clock periods per frame in 24.8 fixed point, capped at 1000 s */
+	if (interval->numerator > (u64)interval->denominator * 1000)
+		target = (u64)IMX585_PIXEL_RATE * 1000 << 8;
+	else
+		target = mul_u64_u32_div((u64)interval->numerator << 8,
+					 IMX585_PIXEL_RATE,
+					 interval->denominator);
+
+	/* HMAX is also bounded by the range of the HBLANK control */
+	hmax_limit = min_t(u32, IMX585_HMAX_MAX,
+			   imx585_hblank_to_hmax(mode, IMX585_HMAX_MAX));
+	hmax_limit = min_t(u64, hmax_limit,
+			   div_u64(target >> 8, mode->min_VMAX));
+	hmax_limit = max_t(u32, hmax_limit, mode->min_HMAX);
+
+	for (hmax = mode->min_HMAX; hmax <= hmax_limit; hmax++) {
+		u64 vmax = DIV_ROUND_CLOSEST_ULL(target, hmax << 8);
+		u64 period, err;
+
+		vmax = clamp_t(u64, vmax, mode->min_VMAX, IMX585_VMAX_MAX);
+		period = ((u64)hmax * vmax) << 8;
+		err = period > target ? period - target : target - period;
+
+		if (err < best_err) {
+			best_err = err;
+			*best_hmax = hmax;
+			*best_vmax = vmax;
+		}
+
+		if (!err)
+			break;
+	}
 }
 
 static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
@@ -1042,7 +1014,7 @@ static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
 	struct imx585 *imx585 = container_of(ctrl->handler, struct imx585, ctrl_handler);
 	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
 	const struct imx585_mode *mode = imx585->mode;
-
+	ktime_t start;
 	int ret = 0;
 
 	/*
@@ -1051,18 +1023,22 @@ static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
 	 */
 	if (ctrl->id == V4L2_CID_VBLANK){
 		/* Honour the VBLANK limits when setting exposure. */
-		u64 current_exposure, max_exposure, min_exposure, vmax;
-		vmax = ((u64)mode->height + ctrl->val) ;
-		imx585 -> VMAX = vmax;
-		
-		calculate_min_max_v4l2_cid_exposure(imx585 -> HMAX, imx585 -> VMAX, (u64)mode->min_SHR, 0, 209, &min_exposure, &max_exposure);
-		current_exposure = clamp_t(uint32_t, current_exposure, min_exposure, max_exposure);
-
-		dev_info(&client->dev,"exposure_max:%lld, exposure_min:%lld, current_exposure:%lld\n",max_exposure, min_exposure, current_exposure);
-		dev_info(&client->dev,"\tVMAX:%d, HMAX:%d\n",imx585->VMAX, imx585->HMAX);
+		u32 current_exposure, max_exposure, min_exposure;
+
+		imx585->VMAX = mode->height + ctrl->val;
+
+		calculate_min_max_v4l2_cid_exposure(imx585->HMAX, imx585->VMAX, mode->min_SHR, 0, IMX585_SHR_OFFSET, &min_exposure, &max_exposure);
+		current_exposure = clamp_t(u32, imx585->exposure->val, min_exposure, max_exposure);
+
+		dev_dbg(&client->dev,"exposure_max:%u, exposure_min:%u, current_exposure:%u\n",max_exposure, min_exposure, current_exposure);
+		dev_dbg(&client->dev,"\tVMAX:%d, HMAX:%d\n",imx585->VMAX, imx585->HMAX);
 		__v4l2_ctrl_modify_range(imx585->exposure, min_exposure,max_exposure, 1,current_exposure);
 	}
 
+	/* Keep HMAX in step with HBLANK so the frame interval can be reported */
+	if (ctrl->id == V4L2_CID_HBLANK)
+		imx585->HMAX = imx585_hblank_to_hmax(mode, ctrl->val);
+
 	/*
 	 * Applying V4L2 control value only happens
 	 * when power is up for streaming
@@ -1070,16 +1046,17 @@ static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (pm_runtime_get_if_in_use(&client->dev) == 0)
 		return 0;
 
+	start = ktime_get();
+
 	switch (ctrl->id) {
 	case V4L2_CID_EXPOSURE:
 		{
-			u64 shr;
-			dev_info(&client->dev,"V4L2_CID_EXPOSURE : %d\n",ctrl->val);
-			dev_info(&client->dev,"\tvblank:%d, hblank:%d\n",imx585->vblank->val, imx585->hblank->val);
-			dev_info(&client->dev,"\tVMAX:%d, HMAX:%d\n",imx585->VMAX, imx585->HMAX);
-			shr = calculate_shr(ctrl->val, imx585->HMAX, imx585->VMAX, 0, 209);
-			dev_info(&client->dev,"\tSHR:%lld\n",shr);
-			ret = imx585_write_reg_2byte(imx585, IMX585_REG_SHR, shr);
+			u32 shr;
+
+			shr = calculate_shr(ctrl->val, imx585->HMAX, imx585->VMAX, 0, IMX585_SHR_OFFSET);
+			dev_dbg(&client->dev,"V4L2_CID_EXPOSURE : %d, VMAX:%d, HMAX:%d, SHR:%u\n",
+				ctrl->val, imx585->VMAX, imx585->HMAX, shr);
+			ret = starvis2_write_multi(&imx585->core, IMX585_REG_SHR, 2, shr);
 		}
 		break;
 	case V4L2_CID_ANALOGUE_GAIN:
@@ -1095,46 +1072,36 @@ static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
 				if ( gain < IMX585_ANA_GAIN_HCG_MIN )
 					gain = IMX585_ANA_GAIN_HCG_MIN;
 			}
-			dev_info(&client->dev,"V4L2_CID_ANALOGUE_GAIN: %d, HGC: %d\n",gain, (int)useHGC);
+			dev_dbg(&client->dev,"V4L2_CID_ANALOGUE_GAIN: %d, HGC: %d\n",gain, (int)useHGC);
 
 			// Apply gain
-			imx585_register_hold(imx585, true);
-			ret = imx585_write_reg_2byte(imx585, IMX585_REG_ANALOG_GAIN, gain);
+			starvis2_hold(&imx585->core, true);
+			ret = starvis2_write_multi(&imx585->core, IMX585_REG_ANALOG_GAIN, 2, gain);
 			if (ret)
 				dev_err_ratelimited(&client->dev, "Failed to write reg 0x%4.4x. error = %d\n", IMX585_REG_ANALOG_GAIN, ret);
 			
 			// Set HGC/LCG channel			
-			ret = imx585_write_reg_1byte(imx585, IMX585_REG_FDG_SEL0, (u16)(useHGC ? 0x01 : 0x00));
-			imx585_register_hold(imx585, false);
+			ret = starvis2_write(&imx585->core, IMX585_REG_FDG_SEL0, (u16)(useHGC ? 0x01 : 0x00));
+			starvis2_hold(&imx585->core, false);
 		}
 		break;
 	case V4L2_CID_VBLANK:
 		{
-			dev_info(&client->dev,"V4L2_CID_VBLANK : %d\n",ctrl->val);
-			imx585->VMAX = ((u64)mode->height + ctrl->val);
-			dev_info(&client->dev,"\tVMAX : %d\n",imx585 -> VMAX);
-			ret = imx585_write_reg_3byte(imx585, IMX585_REG_VMAX, imx585 -> VMAX);
+			dev_dbg(&client->dev,"V4L2_CID_VBLANK : %d, VMAX : %d\n",ctrl->val, imx585->VMAX);
+			ret = starvis2_write_multi(&imx585->core, IMX585_REG_VMAX, 3, imx585 -> VMAX);
 		}
 		break;
 	case V4L2_CID_HBLANK:
 		{
-			u64 pixel_rate;
-			u64 hmax;
-			dev_info(&client->dev,"V4L2_CID_HBLANK : %d\n",ctrl->val);
-			pixel_rate = (u64)mode->width * IMX585_PIXEL_RATE;
-			do_div(pixel_rate,mode->min_HMAX);
-			hmax = (u64)(mode->width + ctrl->val) * IMX585_PIXEL_RATE;
-			do_div(hmax,pixel_rate);
-			imx585 -> HMAX = hmax;
-			dev_info(&client->dev,"\tHMAX : %d\n",imx585 -> HMAX);
-			ret = imx585_write_reg_2byte(imx585, IMX585_REG_HMAX, hmax);
+			dev_dbg(&client->dev,"V4L2_CID_HBLANK : %d, HMAX : %d\n",ctrl->val, imx585->HMAX);
+			ret = starvis2_write_multi(&imx585->core, IMX585_REG_HMAX, 2, imx585->HMAX);
 		}
 		break;
     case V4L2_CID_HFLIP:
-		ret = imx585_write_reg_1byte(imx585, IMX585_FLIP_WINMODEH, ctrl->val);
+		ret = starvis2_write(&imx585->core, IMX585_FLIP_WINMODEH, ctrl->val);
 		break;
 	case V4L2_CID_VFLIP:
-		ret = imx585_write_reg_1byte(imx585, IMX585_FLIP_WINMODEV, ctrl->val);
+		ret = starvis2_write(&imx585->core, IMX585_FLIP_WINMODEV, ctrl->val);
 		break;
 	default:
 		dev_info(&client->dev,
@@ -1144,6 +1111,10 @@ static int imx585_set_ctrl(struct v4l2_ctrl *ctrl)
 		break;
 	}
 
+	imx585->core.stats.ctrl_write_count++;
+	starvis2_stats_update(start, &imx585->core.stats.ctrl_write_last_us,
+			      &imx585->core.stats.ctrl_write_max_us);
+
 	pm_runtime_put(&client->dev);
 
 	return ret;
@@ -1294,15 +1265,10 @@ static void imx585_set_framing_limits(struct imx585 *imx585)
 	imx585->VMAX = mode->default_VMAX;
 	imx585->HMAX = mode->default_HMAX;
 
-	pixel_rate = (u64)mode->width * IMX585_PIXEL_RATE;
-	do_div(pixel_rate,mode->min_HMAX);
+	pixel_rate = imx585_mode_pixel_rate(mode);
 	dev_info(&client->dev,"Pixel Rate : %lld\n",pixel_rate);
 
-
-	//int def_hblank = mode->default_HMAX * IMX585_PIXEL_RATE / 72000000 - IMX585_NATIVE_WIDTH;
-	def_hblank = mode->default_HMAX * pixel_rate;
-	do_div(def_hblank,IMX585_PIXEL_RATE);
-	def_hblank = def_hblank - mode->width;
+	def_hblank = imx585_hmax_to_hblank(mode, mode->default_HMAX);
 	__v4l2_ctrl_modify_range(imx585->hblank, 0,
 				 IMX585_HMAX_MAX, 1, def_hblank);
 
@@ -1403,24 +1369,27 @@ static int imx585_start_streaming(struct imx585 *imx585)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
 	const struct IMX585_reg_list *reg_list;
+	ktime_t start = ktime_get();
+	ktime_t mode_start;
 	int ret;
 	
 	dev_info(&client->dev,"imx585_start_streaming\n");
 
 	if (!imx585->common_regs_written) {
-		ret = imx585_write_regs(imx585, mode_common_regs, ARRAY_SIZE(mode_common_regs));
+		ret = starvis2_write_table(&imx585->core, mode_common_regs, ARRAY_SIZE(mode_common_regs));
 		if (ret) {
 			dev_err(&client->dev, "%s failed to set common settings\n", __func__);
 			return ret;
 		}
-		imx585_write_reg_2byte(imx585, IMX585_REG_BLKLEVEL, IMX585_BLKLEVEL_DEFAULT);
+		starvis2_write_multi(&imx585->core, IMX585_REG_BLKLEVEL, 2, IMX585_BLKLEVEL_DEFAULT);
 		imx585->common_regs_written = true;
 		dev_info(&client->dev,"common_regs_written\n");
 	}
 
 	/* Apply default values of current mode */
+	mode_start = ktime_get();
 	reg_list = &imx585->mode->reg_list;
-	ret = imx585_write_regs(imx585, reg_list->regs, reg_list->num_of_regs);
+	ret = starvis2_write_table(&imx585->core, reg_list->regs, reg_list->num_of_regs);
 	if (ret) {
 		dev_err(&client->dev, "%s failed to set mode\n", __func__);
 		return ret;
@@ -1428,26 +1397,29 @@ static int imx585_start_streaming(struct imx585 *imx585)
 
 	/* Apply gradation compression curve for non-linear mode */
 	if ( !imx585->mode->linear ) {
-		imx585_write_reg_3byte(imx585, IMX585_REG_CCMP1_EXP, 500);
-		imx585_write_reg_1byte(imx585, IMX585_REG_ACMP1_EXP, 0x2);
-		imx585_write_reg_3byte(imx585, IMX585_REG_CCMP2_EXP, 11500);
-		imx585_write_reg_1byte(imx585, IMX585_REG_ACMP2_EXP, 0x6);
+		starvis2_write_multi(&imx585->core, IMX585_REG_CCMP1_EXP, 3, 500);
+		starvis2_write(&imx585->core, IMX585_REG_ACMP1_EXP, 0x2);
+		starvis2_write_multi(&imx585->core, IMX585_REG_CCMP2_EXP, 3, 11500);
+		starvis2_write(&imx585->core, IMX585_REG_ACMP2_EXP, 0x6);
 	} else {
-		imx585_write_reg_3byte(imx585, IMX585_REG_CCMP1_EXP, 0);
-		imx585_write_reg_1byte(imx585, IMX585_REG_ACMP1_EXP, 0);
-		imx585_write_reg_3byte(imx585, IMX585_REG_CCMP2_EXP, 0);
-		imx585_write_reg_1byte(imx585, IMX585_REG_ACMP2_EXP, 0);
+		starvis2_write_multi(&imx585->core, IMX585_REG_CCMP1_EXP, 3, 0);
+		starvis2_write(&imx585->core, IMX585_REG_ACMP1_EXP, 0);
+		starvis2_write_multi(&imx585->core, IMX585_REG_CCMP2_EXP, 3, 0);
+		starvis2_write(&imx585->core, IMX585_REG_ACMP2_EXP, 0);
 	}
 	
 	/* Apply HDR combining options */
 	if ( imx585->mode->hdr ) {
-		imx585_write_reg_2byte(imx585, IMX585_REG_EXP_TH_H, 4095);
-		imx585_write_reg_2byte(imx585, IMX585_REG_EXP_TH_L, 512);
-		imx585_write_reg_1byte(imx585, IMX585_REG_EXP_BK, 0);
+		starvis2_write_multi(&imx585->core, IMX585_REG_EXP_TH_H, 2, 4095);
+		starvis2_write_multi(&imx585->core, IMX585_REG_EXP_TH_L, 2, 512);
+		starvis2_write(&imx585->core, IMX585_REG_EXP_BK, 0);
 	}
 	
 	/* Disable digital clamp */
-	imx585_write_reg_1byte(imx585, IMX585_REG_DIGITAL_CLAMP, 0);
+	starvis2_write(&imx585->core, IMX585_REG_DIGITAL_CLAMP, 0);
+
+	starvis2_stats_update(mode_start, &imx585->core.stats.mode_switch_last_us,
+			      &imx585->core.stats.mode_switch_max_us);
 	
 	/* Apply customized values from user */
 	ret =  __v4l2_ctrl_handler_setup(imx585->sd.ctrl_handler);
@@ -1457,8 +1429,13 @@ static int imx585_start_streaming(struct imx585 *imx585)
 	}
 
 	/* Set stream on register */
-	ret = imx585_write_reg_1byte(imx585, IMX585_REG_MODE_SELECT, IMX585_MODE_STREAMING);
+	ret = starvis2_write(&imx585->core, IMX585_REG_MODE_SELECT, IMX585_MODE_STREAMING);
 	usleep_range(IMX585_STREAM_DELAY_US, IMX585_STREAM_DELAY_US + IMX585_STREAM_DELAY_RANGE_US);
+
+	imx585->core.stats.stream_start_count++;
+	starvis2_stats_update(start, &imx585->core.stats.stream_start_last_us,
+			      &imx585->core.stats.stream_start_max_us);
+
 	return ret;
 }
 
@@ -1471,7 +1448,7 @@ static void imx585_stop_streaming(struct imx585 *imx585)
 	dev_info(&client->dev,"imx585_stop_streaming\n");
 
 	/* set stream off register */
-	ret = imx585_write_reg_1byte(imx585, IMX585_REG_MODE_SELECT, IMX585_MODE_STANDBY);
+	ret = starvis2_write(&imx585->core, IMX585_REG_MODE_SELECT, IMX585_MODE_STANDBY);
 	if (ret)
 		dev_err(&client->dev, "%s failed to stop stream\n", __func__);
 }
@@ -1500,6 +1477,8 @@ static int imx585_set_stream(struct v4l2_subdev *sd, int enable)
 		 * and then start streaming.
 		 */
 		ret = imx585_start_streaming(imx585);
+		/* Only a complete programming pass leaves the cache in sync */
+		imx585->core.regs_cached = !ret;
 		if (ret)
 			goto err_rpm_put;
 	} else {
@@ -1551,6 +1530,9 @@ static int imx585_power_on(struct device *dev)
 	usleep_range(imx585_XCLR_MIN_DELAY_US,
 		     imx585_XCLR_MIN_DELAY_US + imx585_XCLR_DELAY_RANGE_US);
 
+	/* A failed restore only costs a full reprogramming at stream start */
+	starvis2_power_up(&imx585->core);
+
 	return 0;
 
 reg_off:
@@ -1564,6 +1546,8 @@ static int imx585_power_off(struct device *dev)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct imx585 *imx585 = to_imx585(sd);
 
+	starvis2_power_down(&imx585->core);
+
 	gpiod_set_value_cansleep(imx585->reset_gpio, 0);
 	regulator_bulk_disable(imx585_NUM_SUPPLIES, imx585->supplies);
 	clk_disable_unprepare(imx585->xclk);
@@ -1625,10 +1609,9 @@ static int imx585_identify_module(struct imx585 *imx585, u32 expected_id)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&imx585->sd);
 	int ret;
-	u32 val;
+	u8 val;
 
-	ret = imx585_read_reg(imx585, IMX585_REG_CHIP_ID,
-			      1, &val);
+	ret = starvis2_read(&imx585->core, IMX585_REG_CHIP_ID, &val);
 	if (ret) {
 		dev_err(&client->dev, "failed to read chip id %x, with error %d\n",
 			expected_id, ret);
@@ -1677,6 +1660,83 @@ static int imx585_get_selection(struct v4l2_subdev *sd,
 	return -EINVAL;
 }
 
+static int imx585_enum_frame_interval(struct v4l2_subdev *sd,
+				      struct v4l2_subdev_state *sd_state,
+				      struct v4l2_subdev_frame_interval_enum *fie)
+{
+	struct imx585 *imx585 = to_imx585(sd);
+	const struct imx585_mode *mode_list;
+	unsigned int num_modes, i;
+
+	/* Only the fastest rate is reported, slower ones come from VMAX/HMAX */
+	if (fie->pad != IMAGE_PAD || fie->index > 0)
+		return -EINVAL;
+
+	if (fie->code != imx585_get_format_code(imx585, fie->code))
+		return -EINVAL;
+
+	get_mode_table(fie->code, V4L2_XFER_FUNC_DEFAULT, &mode_list, &num_modes);
+
+	for (i = 0; i < num_modes; i++) {
+		if (mode_list[i].width == fie->width &&
+		    mode_list[i].height == fie->height)
+			break;
+	}
+
+	if (i == num_modes)
+		return -EINVAL;
+
+	starvis2_timing_to_interval(mode_list[i].min_HMAX, mode_list[i].min_VMAX,
+				    IMX585_PIXEL_RATE, &fie->interval);
+
+	return 0;
+}
+
+static int imx585_g_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct imx585 *imx585 = to_imx585(sd);
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&imx585->mutex);
+	starvis2_timing_to_interval(imx585->HMAX, imx585->VMAX, IMX585_PIXEL_RATE,
+				    &fi->interval);
+	mutex_unlock(&imx585->mutex);
+
+	return 0;
+}
+
+static int imx585_s_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct imx585 *imx585 = to_imx585(sd);
+	const struct imx585_mode *mode;
+	u32 hmax, vmax;
+	int ret;
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&imx585->mutex);
+
+	mode = imx585->mode;
+	imx585_solve_frame_timing(mode, &fi->interval, &hmax, &vmax);
+
+	/* HBLANK first, the VBLANK handler derives exposure limits from HMAX */
+	ret = __v4l2_ctrl_s_ctrl(imx585->hblank,
+				 imx585_hmax_to_hblank(mode, hmax));
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(imx585->vblank, vmax - mode->height);
+
+	starvis2_timing_to_interval(imx585->HMAX, imx585->VMAX, IMX585_PIXEL_RATE,
+				    &fi->interval);
+
+	mutex_unlock(&imx585->mutex);
+
+	return ret;
+}
 
 static const struct v4l2_subdev_core_ops imx585_core_ops = {
 	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
@@ -1685,6 +1745,8 @@ static const struct v4l2_subdev_core_ops imx585_core_ops = {
 
 static const struct v4l2_subdev_video_ops imx585_video_ops = {
 	.s_stream = imx585_set_stream,
+	.g_frame_interval = imx585_g_frame_interval,
+	.s_frame_interval = imx585_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops imx585_pad_ops = {
@@ -1693,6 +1755,7 @@ static const struct v4l2_subdev_pad_ops imx585_pad_ops = {
 	.set_fmt = imx585_set_pad_format,
 	.get_selection = imx585_get_selection,
 	.enum_frame_size = imx585_enum_frame_size,
+	.enum_frame_interval = imx585_enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops imx585_subdev_ops = {
@@ -1809,6 +1872,12 @@ static const struct of_device_id imx585_dt_ids[] = {
 	{ /* sentinel */ }
 };
 
+/* Clients instantiated without DT, such as the one imx585-emu registers */
+static const struct i2c_device_id imx585_ids[] = {
+	{ "imx585", (kernel_ulong_t)&imx585_compatible },
+	{ /* sentinel */ }
+};
+
 static int imx585_probe(struct i2c_client *client)
 {
 	struct device *dev = &client->dev;
@@ -1822,11 +1891,22 @@ static int imx585_probe(struct i2c_client *client)
 
 	v4l2_i2c_subdev_init(&imx585->sd, client, &imx585_subdev_ops);
 
+	ret = starvis2_init(&imx585->core, client);
+	if (ret)
+		return ret;
+
 	match = of_match_device(imx585_dt_ids, dev);
-	if (!match)
-		return -ENODEV;
-	imx585->compatible_data =
-		(const struct imx585_compatible_data *)match->data;
+	if (match) {
+		imx585->compatible_data =
+			(const struct imx585_compatible_data *)match->data;
+	} else {
+		const struct i2c_device_id *id = i2c_match_id(imx585_ids, client);
+
+		if (!id)
+			return -ENODEV;
+		imx585->compatible_data =
+			(const struct imx585_compatible_data *)id->driver_data;
+	}
 
 	/* Get system clock (xclk) */
 	imx585->xclk = devm_clk_get(dev, NULL);
@@ -1899,6 +1979,8 @@ static int imx585_probe(struct i2c_client *client)
 		goto error_media_entity;
 	}
 
+	starvis2_debugfs_init(&imx585->core, "imx585");
+
 	return 0;
 
 error_media_entity:
@@ -1920,6 +2002,7 @@ static void imx585_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct imx585 *imx585 = to_imx585(sd);
 
+	starvis2_debugfs_remove(&imx585->core);
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
 	imx585_free_controls(imx585);
@@ -1932,6 +2015,7 @@ static void imx585_remove(struct i2c_client *client)
 }
 
 MODULE_DEVICE_TABLE(of, imx585_dt_ids);
+MODULE_DEVICE_TABLE(i2c, imx585_ids);
 
 static const struct dev_pm_ops imx585_pm_ops = {
 	SET_SYSTEM_SLEEP_PM_OPS(imx585_suspend, imx585_resume)
@@ -1946,6 +2030,7 @@ static struct i2c_driver imx585_i2c_driver = {
 	},
 	.probe_new = imx585_probe,
 	.remove = imx585_remove,
+	.id_table = imx585_ids,
 };
 
 module_i2c_driver(imx585_i2c_driver);
@@ -1955,3 +2040,7 @@ MODULE_AUTHOR("Tetsuya NOMURA <tetsuya.nomura@soho-enterprise.com>");
 MODULE_AUTHOR("Russell Newman <russellnewman@octopuscinema.com>");
 MODULE_DESCRIPTION("Sony imx585 sensor driver");
 MODULE_LICENSE("GPL v2");
+
+#if IS_ENABLED(CONFIG_VIDEO_IMX585_KUNIT_TEST)
+#include "imx585-test.c"
+#endif
@@ -19,10 +19,11 @@
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/pm_runtime.h>
-#include <linux/regmap.h>
 #include <linux/regulator/consumer.h>
 #include <media/media-entity.h>
 #include <media/v4l2-ctrls.h>
@@ -31,8 +32,18 @@
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-subdev.h>
 
+#include "sony-starvis2.h"
+
+#ifndef MEDIA_BUS_FMT_Y16_1X16
+#define MEDIA_BUS_FMT_Y16_1X16		0x202e
+#endif
+
+/* Short sub-exposure of DOL HDR, in lines */
+#define V4L2_CID_IMX662_SHORT_EXPOSURE	(V4L2_CID_CAMERA_CLASS_BASE | 0x1000)
+/* Read-only, set while the pixel runs in high conversion gain */
+#define V4L2_CID_IMX662_HCG		(V4L2_CID_CAMERA_CLASS_BASE | 0x1001)
+
 #define IMX662_STANDBY		0x3000
-#define IMX662_REGHOLD		0x3001
 #define IMX662_XMSTA		0x3002
 #define IMX662_INCK_SEL		0x3014
 	#define IMX662_INCK_SEL_74_25	0x00
@@ -49,6 +60,16 @@
 	#define IMX662_LANE_RATE_891	0x05
 	#define IMX662_LANE_RATE_720	0x06
 	#define IMX662_LANE_RATE_594	0x07
+#define IMX662_WINMODE		0x3018
+	#define IMX662_WINMODE_ALL	0x00
+	#define IMX662_WINMODE_CROP	0x04
+#define IMX662_WDMODE		0x301a
+	#define IMX662_WDMODE_NORMAL	0x00
+	#define IMX662_WDMODE_DOL	0x01
+	#define IMX662_WDMODE_CLEAR_HDR	0x10
+#define IMX662_ADDMODE		0x301b
+	#define IMX662_ADDMODE_NORMAL	0x00
+	#define IMX662_ADDMODE_BIN2X2	0x01
 #define IMX662_FLIP_WINMODEH	0x3020
 #define IMX662_FLIP_WINMODEV	0x3021
 #define IMX662_ADBIT		0x3022
@@ -57,20 +78,74 @@
 	#define IMX662_VMAX_MAX		0x03ffff
 #define IMX662_HMAX		0x302c
 	#define IMX662_HMAX_MAX		0xffff
+	/* HMAX counts periods of this clock, whatever the INCK */
+	#define IMX662_HMAX_CLOCK	74250000ULL
+	/*
+	 * Shortest line the ADC supports, the sensor is rated for 90 fps
+	 * with 10-bit and 60 fps with 12-bit conversion.
+	 */
+	#define IMX662_HMAX_MIN_10BIT	660
+	#define IMX662_HMAX_MIN_12BIT	990
+	/*
+	 * Shortest line in 2x2 binning. Not verified against the IMX662
+	 * datasheet, scaled from the imx585 binned mode (HMAX 366 for 660).
+	 */
+	#define IMX662_HMAX_MIN_BIN_10BIT	366
+	#define IMX662_HMAX_MIN_BIN_12BIT	549
 #define IMX662_FR_FDG_SEL0	0x3030
 	#define IMX662_FDG_SEL0_LCG	0x00
 	#define IMX662_FDG_SEL0_HCG	0x01
 #define IMX662_FR_FDG_SEL1	0x3031
 #define IMX662_FR_FDG_SEL2	0x3032
+#define IMX662_PIX_HST		0x303c
+#define IMX662_PIX_HWIDTH	0x303e
 #define IMX662_CSI_LANE_MODE	0x3040
+#define IMX662_PIX_VST		0x3044
+#define IMX662_PIX_VWIDTH	0x3046
 #define IMX662_EXPOSURE		0x3050
+#define IMX662_SHR1		0x3054
+#define IMX662_RHS1		0x3060
 #define IMX662_GAIN		0x3070
+#define IMX662_GAIN_SEF1	0x3072
+#define IMX662_HDR_CFG0		0x3460
+	#define IMX662_HDR_CFG0_NORMAL		0x21
+	#define IMX662_HDR_CFG0_CLEAR_HDR	0x22
+#define IMX662_HDR_CFG1		0x3c40
+	#define IMX662_HDR_CFG1_NORMAL		0x06
+	#define IMX662_HDR_CFG1_CLEAR_HDR	0x05
 
 #define IMX662_EXPOSURE_MIN	1
 #define IMX662_EXPOSURE_STEP	1
 /* Exposure must be this many lines less than VMAX */
 #define IMX662_EXPOSURE_OFFSET  4
 
+/*
+ * DOL HDR timing. The frame set (FSC) is two VMAX periods, the short frame
+ * is read out RHS1 lines after the long one. RHS1 must be 4n + 2 and leave
+ * room for both readouts, SHR1 and SHR0 must stay clear of it.
+ */
+#define IMX662_DOL_SHR1_MIN		2
+#define IMX662_DOL_RHS1_ALIGN		4
+#define IMX662_DOL_RHS1_PHASE		2
+#define IMX662_DOL_RHS1_MARGIN		21
+#define IMX662_DOL_SHR0_MARGIN		2
+#define IMX662_DOL_SHORT_EXPOSURE_DEFAULT	32
+
+/* Gain in 0.3 dB steps, analogue up to 30 dB and digital above */
+#define IMX662_GAIN_MIN		0
+#define IMX662_GAIN_MAX		240
+#define IMX662_GAIN_STEP	1
+#define IMX662_GAIN_DEFAULT	0
+/*
+ * HCG adds IMX662_GAIN_HCG_LEVEL (15.3 dB) of conversion gain, and the gain
+ * code must be at least IMX662_GAIN_HCG_MIN while it is selected. Switching
+ * at the sum of the two keeps the total gain continuous.
+ */
+#define IMX662_GAIN_HCG_LEVEL		51
+#define IMX662_GAIN_HCG_MIN		34
+#define IMX662_GAIN_HCG_THRESHOLD	(IMX662_GAIN_HCG_LEVEL + \
+					 IMX662_GAIN_HCG_MIN)
+
 #define IMX662_NATIVE_WIDTH		1956U
 #define IMX662_NATIVE_HEIGHT		1110U
 #define IMX662_PIXEL_ARRAY_LEFT		0U
@@ -78,6 +153,23 @@
 #define IMX662_PIXEL_ARRAY_WIDTH	1936U
 #define IMX662_PIXEL_ARRAY_HEIGHT	1100U
 
+/*
+ * Keep the sensor powered this long after the last user so a quick restart
+ * skips power sequencing. Adjustable through power/autosuspend_delay_ms.
+ */
+#define IMX662_AUTOSUSPEND_DELAY_MS	2000
+
+/* CSI-2 packet header, footer and HS entry/exit per line, in bits */
+#define IMX662_CSI2_LINE_OVERHEAD	512
+
+/* Window cropping granularity and minimum size */
+#define IMX662_CROP_LEFT_ALIGN		2U
+#define IMX662_CROP_TOP_ALIGN		2U
+#define IMX662_CROP_WIDTH_ALIGN		8U
+#define IMX662_CROP_HEIGHT_ALIGN	4U
+#define IMX662_CROP_MIN_WIDTH		320U
+#define IMX662_CROP_MIN_HEIGHT		240U
+
 static const char * const imx662_supply_name[] = {
 	"vdda",
 	"vddd",
@@ -86,19 +178,22 @@ static const char * const imx662_supply_name[] = {
 
 #define IMX662_NUM_SUPPLIES ARRAY_SIZE(imx662_supply_name)
 
-struct imx662_regval {
-	u16 reg;
-	u8 val;
+struct imx662_gain {
+	u16 code;
+	bool hcg;
 };
 
 struct imx662_mode {
 	u32 width;
 	u32 height;
-	u32 hmax;
 	u32 vmax;
+	/* Readout window, output size is crop / binning */
 	struct v4l2_rect crop;
+	u32 binning;
+	/* DOL HDR, the long and short frames are output on alternate lines */
+	bool dol;
 
-	const struct imx662_regval *mode_data;
+	const struct starvis2_reg *mode_data;
 	u32 mode_data_size;
 };
 
@@ -106,7 +201,10 @@ struct imx662 {
 	struct device *dev;
 	struct clk *xclk;
 	u8 inck_sel;
-	struct regmap *regmap;
+	/* Index into imx662_link_freqs of the rate in use */
+	unsigned int link_freq_idx;
+	/* Register engine and counters shared with the other STARVIS 2 parts */
+	struct starvis2 core;
 	u8 nlanes;
 	u8 bpp;
 
@@ -116,17 +214,34 @@ struct imx662 {
 	struct media_pad pad;
 	struct v4l2_mbus_framefmt current_format;
 	const struct imx662_mode *current_mode;
+	/* Readout window, in pixel array coordinates */
+	struct v4l2_rect crop;
+	/*
+	 * Interval last set by the user, directly or through the blanking
+	 * controls, zero until then
+	 */
+	struct v4l2_fract frame_interval;
+	bool streaming;
 
 	struct regulator_bulk_data supplies[IMX662_NUM_SUPPLIES];
 	struct gpio_desc *rst_gpio;
 
 	struct v4l2_ctrl_handler ctrls;
 	struct v4l2_ctrl *pixel_rate;
-	struct v4l2_ctrl *hblank;
-	struct v4l2_ctrl *vblank;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vflip;
-	struct v4l2_ctrl *exposure;
+	struct v4l2_ctrl *hcg;
+	struct {
+		/* Committed together under one register hold */
+		struct v4l2_ctrl *exposure;
+		struct v4l2_ctrl *gain;
+		struct v4l2_ctrl *vblank;
+		struct v4l2_ctrl *hblank;
+		struct v4l2_ctrl *short_exposure;
+	};
+
+	/* Register settings for each analogue gain control value */
+	struct imx662_gain gain_table[IMX662_GAIN_MAX + 1];
 
 	struct mutex lock;
 };
@@ -136,25 +251,22 @@ struct imx662_pixfmt {
 	u8 bpp;
 };
 
-#define IMX662_NUM_FORMATS 2
+#define IMX662_NUM_FORMATS 3
 
+/* 16-bit output selects Clear HDR, the sensor combines both gains */
 static const struct imx662_pixfmt imx662_colour_formats[IMX662_NUM_FORMATS] = {
 	{ MEDIA_BUS_FMT_SRGGB10_1X10, 10 },
 	{ MEDIA_BUS_FMT_SRGGB12_1X12, 12 },
+	{ MEDIA_BUS_FMT_SRGGB16_1X16, 16 },
 };
 
 static const struct imx662_pixfmt imx662_mono_formats[IMX662_NUM_FORMATS] = {
 	{ MEDIA_BUS_FMT_Y10_1X10, 10 },
 	{ MEDIA_BUS_FMT_Y12_1X12, 12 },
+	{ MEDIA_BUS_FMT_Y16_1X16, 16 },
 };
 
-static const struct regmap_config imx662_regmap_config = {
-	.reg_bits = 16,
-	.val_bits = 8,
-	.cache_type = REGCACHE_RBTREE,
-};
-
-static const struct imx662_regval imx662_global_settings[] = {
+static const struct starvis2_reg imx662_global_settings[] = {
 	{0x3002, 0x00}, //#Master mode operation start
 	{0x301A, 0x00}, // HDR mode select (Normal)
 	{0x301B, 0x00}, // Normal/binning
@@ -286,41 +398,45 @@ static const struct imx662_regval imx662_global_settings[] = {
 	{0x4549, 0x03}, // RESERVED
 };
 
-static const struct imx662_regval imx662_1080p_common_settings[] = {
+static const struct starvis2_reg imx662_1080p_common_settings[] = {
 	/* mode settings */
 	{0x3018, 0x00}, // WINMODE
+	{ IMX662_ADDMODE, IMX662_ADDMODE_NORMAL },
 	{ IMX662_FR_FDG_SEL1, 0x00 },
 	{ IMX662_FR_FDG_SEL2, 0x00 },
 };
 
-/* supported link frequencies */
-static const s64 imx662_link_freq_2lanes[] = {
-	594000000,
+static const struct starvis2_reg imx662_binning_settings[] = {
+	/* mode settings */
+	{0x3018, 0x00}, // WINMODE
+	{ IMX662_ADDMODE, IMX662_ADDMODE_BIN2X2 },
+	{ IMX662_FR_FDG_SEL1, 0x00 },
+	{ IMX662_FR_FDG_SEL2, 0x00 },
 };
 
-static const s64 imx662_link_freq_4lanes[] = {
+/* supported link frequencies, half the lane rate, fastest first */
+static const s64 imx662_link_freqs[] = {
+	1188000000,
+	1039500000,
+	891000000,
+	720000000,
+	594000000,
+	445500000,
+	360000000,
 	297000000,
 };
 
-/*
- * In this function and in the similar ones below we rely on imx662_probe()
- * to ensure that nlanes is either 2 or 4.
- */
-static inline const s64 *imx662_link_freqs_ptr(const struct imx662 *imx662)
-{
-	if (imx662->nlanes == 2)
-		return imx662_link_freq_2lanes;
-	else
-		return imx662_link_freq_4lanes;
-}
-
-static inline int imx662_link_freqs_num(const struct imx662 *imx662)
-{
-	if (imx662->nlanes == 2)
-		return ARRAY_SIZE(imx662_link_freq_2lanes);
-	else
-		return ARRAY_SIZE(imx662_link_freq_4lanes);
-}
+/* LANE_RATE value for each entry of imx662_link_freqs */
+static const u8 imx662_lane_rates[] = {
+	IMX662_LANE_RATE_2376,
+	IMX662_LANE_RATE_2079,
+	IMX662_LANE_RATE_1782,
+	IMX662_LANE_RATE_1440,
+	IMX662_LANE_RATE_1188,
+	IMX662_LANE_RATE_891,
+	IMX662_LANE_RATE_720,
+	IMX662_LANE_RATE_594,
+};
 
 /* Mode configs */
 static const struct imx662_mode imx662_modes[] = {
@@ -332,14 +448,82 @@ static const struct imx662_mode imx662_modes[] = {
 		 */
 		.width = 1936,
 		.height = 1100,
-		.hmax = (0x3de * 2), //0x0898, //0x0898, //0x07bc
 		.vmax = 0x04e2,
 		.crop = {
 			.left = IMX662_PIXEL_ARRAY_LEFT,
 			.top = IMX662_PIXEL_ARRAY_TOP,
-			.width = IMX662_NATIVE_WIDTH,
-			.height = IMX662_NATIVE_HEIGHT,
+			.width = IMX662_PIXEL_ARRAY_WIDTH,
+			.height = IMX662_PIXEL_ARRAY_HEIGHT,
+		},
+		.binning = 1,
+		.mode_data = imx662_1080p_common_settings,
+		.mode_data_size = ARRAY_SIZE(imx662_1080p_common_settings),
+	},
+	{
+		/* 720p window from the centre of the array */
+		.width = 1280,
+		.height = 720,
+		.vmax = 0x0366,
+		.crop = {
+			.left = IMX662_PIXEL_ARRAY_LEFT + 328,
+			.top = IMX662_PIXEL_ARRAY_TOP + 190,
+			.width = 1280,
+			.height = 720,
+		},
+		.binning = 1,
+		.mode_data = imx662_1080p_common_settings,
+		.mode_data_size = ARRAY_SIZE(imx662_1080p_common_settings),
+	},
+	{
+		/*
+		 * 2x2 binning of the full array. As in the imx585 binned
+		 * mode, VMAX stays at the full readout value and the rate
+		 * comes from the shorter line, see IMX662_HMAX_MIN_BIN_10BIT.
+		 * Binning is only used with the full array, the window
+		 * modes are not combined with it.
+		 */
+		.width = 968,
+		.height = 550,
+		.vmax = 0x04e2,
+		.crop = {
+			.left = IMX662_PIXEL_ARRAY_LEFT,
+			.top = IMX662_PIXEL_ARRAY_TOP,
+			.width = IMX662_PIXEL_ARRAY_WIDTH,
+			.height = IMX662_PIXEL_ARRAY_HEIGHT,
 		},
+		.binning = 2,
+		.mode_data = imx662_binning_settings,
+		.mode_data_size = ARRAY_SIZE(imx662_binning_settings),
+	},
+	{
+		/* DOL HDR of the full array, long and short lines alternate */
+		.width = 1936,
+		.height = 2200,
+		.vmax = 0x04e2,
+		.crop = {
+			.left = IMX662_PIXEL_ARRAY_LEFT,
+			.top = IMX662_PIXEL_ARRAY_TOP,
+			.width = IMX662_PIXEL_ARRAY_WIDTH,
+			.height = IMX662_PIXEL_ARRAY_HEIGHT,
+		},
+		.binning = 1,
+		.dol = true,
+		.mode_data = imx662_1080p_common_settings,
+		.mode_data_size = ARRAY_SIZE(imx662_1080p_common_settings),
+	},
+	{
+		/* DOL HDR of the 720p window */
+		.width = 1280,
+		.height = 1440,
+		.vmax = 0x0366,
+		.crop = {
+			.left = IMX662_PIXEL_ARRAY_LEFT + 328,
+			.top = IMX662_PIXEL_ARRAY_TOP + 190,
+			.width = 1280,
+			.height = 720,
+		},
+		.binning = 1,
+		.dol = true,
 		.mode_data = imx662_1080p_common_settings,
 		.mode_data_size = ARRAY_SIZE(imx662_1080p_common_settings),
 	},
@@ -352,124 +536,206 @@ static inline struct imx662 *to_imx662(struct v4l2_subdev *_sd)
 	return container_of(_sd, struct imx662, sd);
 }
 
-static inline int imx662_read_reg(struct imx662 *imx662, u16 addr, u8 *value)
+/* Output lines per readout line, DOL interleaves the two sub-frames */
+static inline u32 imx662_mode_frames(const struct imx662_mode *mode)
 {
-	unsigned int regval;
-	int ret;
+	return mode->dol ? 2 : 1;
+}
 
-	ret = regmap_read(imx662->regmap, addr, &regval);
-	if (ret) {
-		dev_err(imx662->dev, "I2C read failed for addr: %x\n", addr);
-		return ret;
+/* DOL cannot be combined with the 16-bit Clear HDR output */
+static bool imx662_mode_supported(const struct imx662_mode *mode, u8 bpp)
+{
+	return !(mode->dol && bpp == 16);
+}
+
+static const struct imx662_mode *imx662_find_mode(u8 bpp, u32 width,
+						  u32 height)
+{
+	const struct imx662_mode *mode, *best = NULL;
+	u32 dist, best_dist = U32_MAX;
+	unsigned int i;
+
+	for (i = 0; i < IMX662_NUM_MODES; i++) {
+		mode = &imx662_modes[i];
+		if (!imx662_mode_supported(mode, bpp))
+			continue;
+
+		dist = abs((s32)mode->width - (s32)width) +
+		       abs((s32)mode->height - (s32)height);
+		if (dist < best_dist) {
+			best_dist = dist;
+			best = mode;
+		}
 	}
 
-	*value = regval & 0xff;
+	return best;
+}
 
-	return 0;
+/* Smallest valid RHS1 that leaves room for the short exposure */
+static u32 imx662_dol_rhs1(u32 short_exposure)
+{
+	u32 rhs1 = IMX662_DOL_SHR1_MIN + short_exposure + 1;
+
+	return ALIGN(rhs1 - IMX662_DOL_RHS1_PHASE, IMX662_DOL_RHS1_ALIGN) +
+	       IMX662_DOL_RHS1_PHASE;
 }
 
-static int imx662_write_reg(struct imx662 *imx662, u16 addr, u8 value)
+/* Largest valid RHS1 for a frame set of fsc output lines */
+static u32 imx662_dol_rhs1_max(u32 fsc, u32 height)
 {
-	int ret;
+	u32 rhs1 = fsc - height - IMX662_DOL_RHS1_MARGIN;
 
-	ret = regmap_write(imx662->regmap, addr, value);
-	if (ret) {
-		dev_err(imx662->dev, "I2C write failed for addr: %x\n", addr);
-		return ret;
-	}
+	return ALIGN_DOWN(rhs1 - IMX662_DOL_RHS1_PHASE,
+			  IMX662_DOL_RHS1_ALIGN) + IMX662_DOL_RHS1_PHASE;
+}
 
-	return ret;
+/* Cluster member set by the caller or adjusted by try_ctrl */
+static inline bool imx662_ctrl_changed(const struct v4l2_ctrl *ctrl)
+{
+	return ctrl->is_new || ctrl->has_changed;
 }
 
-static int imx662_set_register_array(struct imx662 *imx662,
-				     const struct imx662_regval *settings,
-				     unsigned int num_settings)
+/*
+ * The set_* helpers below write the registers directly, the caller brackets
+ * them with REGHOLD so they are latched together.
+ */
+/*
+ * The pixel rate is the rate at which the CSI-2 link carries pixels. HBLANK
+ * is expressed in these pixels and converted to HMAX clocks when written.
+ */
+static u64 imx662_calc_pixel_rate(struct imx662 *imx662)
 {
-	unsigned int i;
-	int ret;
+	u64 link_freq = imx662_link_freqs[imx662->link_freq_idx];
 
-	for (i = 0; i < num_settings; ++i, ++settings) {
-		ret = imx662_write_reg(imx662, settings->reg, settings->val);
-		if (ret < 0)
-			return ret;
-	}
+	return div_u64(link_freq * 2 * imx662->nlanes, imx662->bpp);
+}
 
-	/* Provide 10ms settle time */
-	usleep_range(10000, 11000);
+static u32 imx662_hmax_to_line(struct imx662 *imx662, u32 hmax)
+{
+	return DIV_ROUND_UP_ULL((u64)hmax * imx662_calc_pixel_rate(imx662),
+				IMX662_HMAX_CLOCK);
+}
 
-	return 0;
+static u32 imx662_line_to_hmax(struct imx662 *imx662, u32 line)
+{
+	return div_u64((u64)line * IMX662_HMAX_CLOCK,
+		       imx662_calc_pixel_rate(imx662));
 }
 
-static int imx662_write_buffered_reg(struct imx662 *imx662, u16 address_low,
-				     u8 nr_regs, u32 value)
+/*
+ * The line period must cover both the ADC conversion and the transfer of
+ * the line over the link, whichever is longer.
+ */
+static u32 imx662_hmax_min(struct imx662 *imx662,
+			   const struct imx662_mode *mode, u32 width, u8 bpp)
 {
-	unsigned int i;
-	int ret;
+	u64 link_freq = imx662_link_freqs[imx662->link_freq_idx];
+	u64 bits = (u64)width * bpp + IMX662_CSI2_LINE_OVERHEAD;
+	u32 adc, link;
 
-	ret = imx662_write_reg(imx662, IMX662_REGHOLD, 0x01);
-	if (ret) {
-		dev_err(imx662->dev, "Error setting hold register\n");
-		return ret;
-	}
+	if (mode->binning > 1)
+		adc = bpp == 10 ? IMX662_HMAX_MIN_BIN_10BIT :
+				  IMX662_HMAX_MIN_BIN_12BIT;
+	else
+		adc = bpp == 10 ? IMX662_HMAX_MIN_10BIT : IMX662_HMAX_MIN_12BIT;
 
-	for (i = 0; i < nr_regs; i++) {
-		ret = imx662_write_reg(imx662, address_low + i,
-				       (u8)(value >> (i * 8)));
-		if (ret) {
-			dev_err(imx662->dev, "Error writing buffered registers\n");
-			return ret;
-		}
-	}
+	link = DIV64_U64_ROUND_UP(bits * IMX662_HMAX_CLOCK,
+				  link_freq * 2 * imx662->nlanes);
 
-	ret = imx662_write_reg(imx662, IMX662_REGHOLD, 0x00);
-	if (ret) {
-		dev_err(imx662->dev, "Error setting hold register\n");
-		return ret;
-	}
+	return max(adc, link);
+}
 
-	return ret;
+/* Shortest VMAX of a mode, Clear HDR reads every line twice */
+static u32 imx662_vmax_min(const struct imx662_mode *mode, u8 bpp)
+{
+	return bpp == 16 ? mode->vmax * 2 : mode->vmax;
+}
+
+static void imx662_init_gain_table(struct imx662 *imx662)
+{
+	struct imx662_gain *entry;
+	unsigned int i;
+
+	for (i = 0; i <= IMX662_GAIN_MAX; i++) {
+		entry = &imx662->gain_table[i];
+		entry->hcg = i >= IMX662_GAIN_HCG_THRESHOLD;
+		entry->code = entry->hcg ? i - IMX662_GAIN_HCG_LEVEL : i;
+	}
 }
 
+/*
+ * HCG is only switched in normal readout, both HDR modes manage the
+ * conversion gain themselves. FDG_SEL0 is written under the same hold as the
+ * gain code, so both take effect on the same frame. The HCG control only
+ * reflects the most recent setting, not the frame it applies to.
+ */
 static int imx662_set_gain(struct imx662 *imx662, u32 value)
 {
+	const struct imx662_gain *entry = &imx662->gain_table[value];
+	bool hdr = imx662->bpp == 16 || imx662->current_mode->dol;
+	bool hcg = !hdr && entry->hcg;
+	u16 code = hdr ? value : entry->code;
 	int ret;
 
-	ret = imx662_write_buffered_reg(imx662, IMX662_GAIN, 2, value);
+	ret = starvis2_write_multi(&imx662->core, IMX662_GAIN, 2, code);
+	/* The short frame of DOL HDR follows the long frame gain */
+	if (!ret && imx662->current_mode->dol)
+		ret = starvis2_write_multi(&imx662->core, IMX662_GAIN_SEF1, 2,
+					   code);
 	if (ret) {
 		dev_err(imx662->dev, "Unable to write gain\n");
 		return ret;
 	}
 
-	ret = imx662_write_reg(imx662, IMX662_FR_FDG_SEL0, value < 0x22 ?
-			       IMX662_FDG_SEL0_LCG : IMX662_FDG_SEL0_LCG);
-	if (ret)
+	ret = starvis2_write(&imx662->core, IMX662_FR_FDG_SEL0, hcg ?
+			     IMX662_FDG_SEL0_HCG : IMX662_FDG_SEL0_LCG);
+	if (ret) {
 		dev_err(imx662->dev, "Unable to write LCG/HCG mode\n");
+		return ret;
+	}
 
-	return ret;
+	if (imx662->hcg->val != hcg)
+		__v4l2_ctrl_s_ctrl(imx662->hcg, hcg);
+
+	return 0;
 }
 
 static int imx662_set_exposure(struct imx662 *imx662, u32 value)
 {
-	u32 exposure = (imx662->current_mode->height + imx662->vblank->val) -
+	u32 exposure = (imx662->current_format.height + imx662->vblank->val) -
 						value - 1;
 	int ret;
 
-	ret = imx662_write_buffered_reg(imx662, IMX662_EXPOSURE, 3,
-					exposure);
-					//0x000004);
+	ret = starvis2_write_multi(&imx662->core, IMX662_EXPOSURE, 3, exposure);
 	if (ret)
 		dev_err(imx662->dev, "Unable to write exposure\n");
 
 	return ret;
 }
 
+/* RHS1 is kept as small as possible to minimise the long/short offset */
+static int imx662_set_short_exposure(struct imx662 *imx662, u32 value)
+{
+	u32 rhs1 = imx662_dol_rhs1(value);
+	int ret;
+
+	ret = starvis2_write_multi(&imx662->core, IMX662_RHS1, 3, rhs1);
+	if (!ret)
+		ret = starvis2_write_multi(&imx662->core, IMX662_SHR1, 3,
+					   rhs1 - value - 1);
+	if (ret)
+		dev_err(imx662->dev, "Unable to write short exposure\n");
+
+	return ret;
+}
+
 static int imx662_set_hmax(struct imx662 *imx662, u32 val)
 {
-	u32 hmax = (val + imx662->current_mode->width) >> 1;
+	u32 hmax = imx662_line_to_hmax(imx662,
+				       val + imx662->current_format.width);
 	int ret;
 
-	ret = imx662_write_buffered_reg(imx662, IMX662_HMAX, 2,
-					hmax);
+	ret = starvis2_write_multi(&imx662->core, IMX662_HMAX, 2, hmax);
 	if (ret)
 		dev_err(imx662->dev, "Error setting HMAX register\n");
 
@@ -478,35 +744,54 @@ static int imx662_set_hmax(struct imx662 *imx662, u32 val)
 
 static int imx662_set_vmax(struct imx662 *imx662, u32 val)
 {
-	u32 vmax = val + imx662->current_mode->height;
-
+	u32 vmax = (val + imx662->current_format.height) /
+		   imx662_mode_frames(imx662->current_mode);
 	int ret;
 
-	ret = imx662_write_buffered_reg(imx662, IMX662_VMAX, 3,
-					vmax);
-					//0x000465);
+	ret = starvis2_write_multi(&imx662->core, IMX662_VMAX, 3, vmax);
 	if (ret)
 		dev_err(imx662->dev, "Unable to write vmax\n");
 
-	/*
-	 * Changing vblank changes the allowed range for exposure.
-	 * We don't supply the current exposure as default here as it
-	 * may lie outside the new range. We will reset it just below.
-	 */
-	__v4l2_ctrl_modify_range(imx662->exposure,
-				 IMX662_EXPOSURE_MIN,
-				 vmax - IMX662_EXPOSURE_OFFSET,
-				 IMX662_EXPOSURE_STEP,
-				 vmax - IMX662_EXPOSURE_OFFSET);
+	return ret;
+}
 
-	/*
-	 * Becuse of the way exposure works for this sensor, updating
-	 * vblank causes the effective exposure to change, so we must
-	 * set it back to the "new" correct value.
-	 */
-	imx662_set_exposure(imx662, imx662->exposure->val);
+/*
+ * Write every changed member of the exposure cluster inside a single
+ * REGHOLD bracket. The sensor latches held registers at the next frame
+ * boundary, so frame length, exposure and gain all change on the same frame.
+ * The shutter position depends on VMAX, so it is rewritten whenever VBLANK
+ * changes.
+ */
+static int imx662_set_exposure_cluster(struct imx662 *imx662)
+{
+	bool vblank_changed = imx662_ctrl_changed(imx662->vblank);
+	int ret, err;
 
-	return ret;
+	ret = starvis2_hold(&imx662->core, true);
+	if (ret) {
+		dev_err(imx662->dev, "Error setting hold register\n");
+		return ret;
+	}
+
+	if (vblank_changed)
+		ret = imx662_set_vmax(imx662, imx662->vblank->val);
+	if (!ret && imx662_ctrl_changed(imx662->hblank))
+		ret = imx662_set_hmax(imx662, imx662->hblank->val);
+	if (!ret && (imx662_ctrl_changed(imx662->exposure) || vblank_changed))
+		ret = imx662_set_exposure(imx662, imx662->exposure->val);
+	if (!ret && imx662->current_mode->dol &&
+	    imx662_ctrl_changed(imx662->short_exposure))
+		ret = imx662_set_short_exposure(imx662,
+						imx662->short_exposure->val);
+	if (!ret && imx662_ctrl_changed(imx662->gain))
+		ret = imx662_set_gain(imx662, imx662->gain->val);
+
+	/* Release the hold even after a failed write */
+	err = starvis2_hold(&imx662->core, false);
+	if (err)
+		dev_err(imx662->dev, "Error setting hold register\n");
+
+	return ret ?: err;
 }
 
 /* Stop streaming */
@@ -514,58 +799,172 @@ static int imx662_stop_streaming(struct imx662 *imx662)
 {
 	int ret;
 
-	ret = imx662_write_reg(imx662, IMX662_STANDBY, 0x01);
+	ret = starvis2_write(&imx662->core, IMX662_STANDBY, 0x01);
 	if (ret < 0)
 		return ret;
 
 	msleep(30);
 
-	return imx662_write_reg(imx662, IMX662_XMSTA, 0x01);
+	return starvis2_write(&imx662->core, IMX662_XMSTA, 0x01);
+}
+
+/*
+ * The exposures and VBLANK are one cluster, so a request changing several of
+ * them is checked against the new frame length here. The exposure range then
+ * follows the committed VBLANK, see imx662_vblank_notify(). In DOL HDR the
+ * long exposure must also end before the short frame is read.
+ */
+static int imx662_try_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct imx662 *imx662 = container_of(ctrl->handler,
+					     struct imx662, ctrls);
+	u32 height = imx662->current_format.height;
+	u32 fsc = height + imx662->vblank->val;
+	s32 max = fsc - IMX662_EXPOSURE_OFFSET;
+	u32 rhs1;
+
+	if (ctrl->id != V4L2_CID_EXPOSURE)
+		return 0;
+
+	if (imx662->current_mode->dol) {
+		rhs1 = imx662_dol_rhs1_max(fsc, height);
+		imx662->short_exposure->val =
+			min_t(s32, imx662->short_exposure->val,
+			      rhs1 - IMX662_DOL_SHR1_MIN - 1);
+
+		rhs1 = imx662_dol_rhs1(imx662->short_exposure->val);
+		max = min_t(s32, max,
+			    fsc - rhs1 - IMX662_DOL_SHR0_MARGIN - 1);
+	}
+
+	imx662->exposure->val = min_t(s32, imx662->exposure->val, max);
+
+	return 0;
+}
+
+static void imx662_get_frame_interval(struct imx662 *imx662,
+				      struct v4l2_fract *interval)
+{
+	u32 hmax = imx662_line_to_hmax(imx662, imx662->current_format.width +
+					       imx662->hblank->val);
+
+	starvis2_timing_to_interval(hmax, imx662->current_format.height +
+					  imx662->vblank->val,
+				    IMX662_HMAX_CLOCK, interval);
+}
+
+static bool imx662_blanking_set(const struct v4l2_ctrl *vblank,
+				const struct v4l2_ctrl *hblank)
+{
+	return (vblank->is_new && vblank->val != vblank->cur.val) ||
+	       (hblank->is_new && hblank->val != hblank->cur.val);
 }
 
 static int imx662_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct imx662 *imx662 = container_of(ctrl->handler,
 					     struct imx662, ctrls);
+	ktime_t start;
 	int ret = 0;
 
-	/* V4L2 controls values will be applied only when power is already up */
-	if (!pm_runtime_get_if_in_use(imx662->dev))
+	/* Blanking set by the user defines the interval kept across formats */
+	if (ctrl == imx662->exposure &&
+	    imx662_blanking_set(imx662->vblank, imx662->hblank))
+		imx662_get_frame_interval(imx662, &imx662->frame_interval);
+
+	/*
+	 * V4L2 controls values will be applied only when power is already up.
+	 * Runtime PM is still disabled while probe sets up the controls.
+	 */
+	if (pm_runtime_get_if_in_use(imx662->dev) <= 0)
 		return 0;
 
+	start = ktime_get();
+
 	switch (ctrl->id) {
-	case V4L2_CID_ANALOGUE_GAIN:
-		ret = imx662_set_gain(imx662, ctrl->val);
-		break;
 	case V4L2_CID_EXPOSURE:
-		ret = imx662_set_exposure(imx662, ctrl->val);
-		break;
-	case V4L2_CID_HBLANK:
-		ret = imx662_set_hmax(imx662, ctrl->val);
-		break;
-	case V4L2_CID_VBLANK:
-		ret = imx662_set_vmax(imx662, ctrl->val);
+		/* Cluster master, also covers gain and blanking */
+		ret = imx662_set_exposure_cluster(imx662);
 		break;
 	case V4L2_CID_HFLIP:
-		ret = imx662_write_reg(imx662, IMX662_FLIP_WINMODEH, ctrl->val);
+		ret = starvis2_write(&imx662->core, IMX662_FLIP_WINMODEH,
+				     ctrl->val);
 		break;
 	case V4L2_CID_VFLIP:
-		ret = imx662_write_reg(imx662, IMX662_FLIP_WINMODEV, ctrl->val);
+		ret = starvis2_write(&imx662->core, IMX662_FLIP_WINMODEV,
+				     ctrl->val);
+		break;
+	case V4L2_CID_IMX662_HCG:
+		/* Status only, follows the analogue gain */
 		break;
 	default:
 		ret = -EINVAL;
 		break;
 	}
 
+	imx662->core.stats.ctrl_write_count++;
+	starvis2_stats_update(start, &imx662->core.stats.ctrl_write_last_us,
+			      &imx662->core.stats.ctrl_write_max_us);
+
 	pm_runtime_put(imx662->dev);
 
 	return ret;
 }
 
+/* The longest exposure is bounded by the current frame length */
+static void imx662_update_exposure_range(struct imx662 *imx662)
+{
+	u32 height = imx662->current_format.height;
+
+	__v4l2_ctrl_modify_range(imx662->exposure, IMX662_EXPOSURE_MIN,
+				 height + imx662->vblank->val -
+				 IMX662_EXPOSURE_OFFSET,
+				 IMX662_EXPOSURE_STEP,
+				 height + imx662->vblank->minimum -
+				 IMX662_EXPOSURE_OFFSET);
+}
+
+/*
+ * Called with the handler lock held once a new VBLANK has been committed.
+ * imx662_try_ctrl() already clamped the exposure to the new frame, so the
+ * range change never has to adjust the value and re-enter the cluster.
+ */
+static void imx662_vblank_notify(struct v4l2_ctrl *ctrl, void *priv)
+{
+	struct imx662 *imx662 = priv;
+
+	imx662_update_exposure_range(imx662);
+}
+
 static const struct v4l2_ctrl_ops imx662_ctrl_ops = {
+	.try_ctrl = imx662_try_ctrl,
 	.s_ctrl = imx662_set_ctrl,
 };
 
+static const struct v4l2_ctrl_config imx662_short_exposure_ctrl = {
+	.ops = &imx662_ctrl_ops,
+	.id = V4L2_CID_IMX662_SHORT_EXPOSURE,
+	.name = "Short Exposure",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = IMX662_EXPOSURE_MIN,
+	.max = IMX662_VMAX_MAX,
+	.step = IMX662_EXPOSURE_STEP,
+	.def = IMX662_DOL_SHORT_EXPOSURE_DEFAULT,
+	.flags = V4L2_CTRL_FLAG_INACTIVE,
+};
+
+static const struct v4l2_ctrl_config imx662_hcg_ctrl = {
+	.ops = &imx662_ctrl_ops,
+	.id = V4L2_CID_IMX662_HCG,
+	.name = "High Conversion Gain",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 0,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+};
+
 static int imx662_enum_mbus_code(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_state *sd_state,
 				 struct v4l2_subdev_mbus_code_enum *code)
@@ -585,20 +984,33 @@ static int imx662_enum_frame_size(struct v4l2_subdev *sd,
 				  struct v4l2_subdev_frame_size_enum *fse)
 {
 	const struct imx662 *imx662 = to_imx662(sd);
+	const struct imx662_mode *mode;
+	unsigned int i, index = 0;
+	u8 bpp = 0;
 
-	if (fse->code != imx662->formats[0].code &&
-	    fse->code != imx662->formats[1].code)
-		return -EINVAL;
+	for (i = 0; i < IMX662_NUM_FORMATS; i++)
+		if (imx662->formats[i].code == fse->code)
+			bpp = imx662->formats[i].bpp;
 
-	if (fse->index >= IMX662_NUM_MODES)
+	if (!bpp)
 		return -EINVAL;
 
-	fse->min_width = imx662_modes[fse->index].width;
-	fse->max_width = imx662_modes[fse->index].width;
-	fse->min_height = imx662_modes[fse->index].height;
-	fse->max_height = imx662_modes[fse->index].height;
+	for (i = 0; i < IMX662_NUM_MODES; i++) {
+		mode = &imx662_modes[i];
+		if (!imx662_mode_supported(mode, bpp))
+			continue;
 
-	return 0;
+		if (index++ == fse->index) {
+			fse->min_width = mode->width;
+			fse->max_width = mode->width;
+			fse->min_height = mode->height;
+			fse->max_height = mode->height;
+
+			return 0;
+		}
+	}
+
+	return -EINVAL;
 }
 
 static int imx662_get_fmt(struct v4l2_subdev *sd,
@@ -623,9 +1035,180 @@ static int imx662_get_fmt(struct v4l2_subdev *sd,
 	return 0;
 }
 
-static u64 imx662_calc_pixel_rate(struct imx662 *imx662)
+/*
+ * VBLANK giving the frame period closest to the interval at the current line
+ * length, within the range of the control.
+ */
+static u32 imx662_interval_to_vblank(struct imx662 *imx662,
+				     const struct v4l2_fract *interval)
+{
+	struct v4l2_ctrl *vblank = imx662->vblank;
+	u32 height = imx662->current_format.height;
+	u32 hmax = imx662_line_to_hmax(imx662, imx662->current_format.width +
+					       imx662->hblank->val);
+	u64 lines;
+	u32 extra, val;
+
+	if (!interval->numerator || !interval->denominator || !hmax)
+		return vblank->minimum;
+
+	lines = DIV_ROUND_CLOSEST_ULL(mul_u64_u32_div(interval->numerator,
+						      IMX662_HMAX_CLOCK,
+						      interval->denominator),
+				      hmax);
+	lines = clamp_t(u64, lines, height + vblank->minimum,
+			height + vblank->maximum);
+
+	/* In DOL HDR the closest valid VBLANK may be one step either way */
+	extra = lines - height - vblank->minimum;
+	val = vblank->minimum +
+	      DIV_ROUND_CLOSEST(extra, (u32)vblank->step) * vblank->step;
+	if (val > vblank->maximum)
+		val -= vblank->step;
+
+	return val;
+}
+
+/*
+ * Update the blanking and exposure limits for the current mode and readout
+ * window. The shortest line is limited by the ADC and by the link bandwidth
+ * for the output width. The vertical blanking overhead of the mode is kept,
+ * so a shorter window gives a proportionally shorter frame. Binned modes
+ * keep the full readout VMAX and have a shorter minimum line instead.
+ *
+ * In DOL HDR the frame set spans two VMAX periods and is reported as one
+ * frame of interleaved lines, so VBLANK moves in steps of two. Clear HDR
+ * reads every line at both gains, which doubles the minimum VMAX.
+ */
+static void imx662_update_framing(struct imx662 *imx662)
+{
+	const struct imx662_mode *mode = imx662->current_mode;
+	u32 frames = imx662_mode_frames(mode);
+	u32 width = imx662->current_format.width;
+	u32 height = imx662->current_format.height;
+	u32 vmax_min = imx662_vmax_min(mode, imx662->bpp);
+	u32 vblank_min = vmax_min * frames - mode->height;
+	u32 hblank_min = imx662_hmax_to_line(imx662,
+					     imx662_hmax_min(imx662, mode, width,
+							     imx662->bpp)) -
+			 width;
+	u32 hblank_max = imx662_hmax_to_line(imx662, IMX662_HMAX_MAX) - width;
+	/* The blanking updates below are not user requests */
+	struct v4l2_fract interval = imx662->frame_interval;
+
+	if (imx662->pixel_rate)
+		__v4l2_ctrl_s_ctrl_int64(imx662->pixel_rate,
+					 imx662_calc_pixel_rate(imx662));
+
+	/* The line length is kept while it is still valid */
+	if (imx662->hblank)
+		__v4l2_ctrl_modify_range(imx662->hblank, hblank_min, hblank_max,
+					 1, hblank_min);
+	if (imx662->vblank) {
+		__v4l2_ctrl_modify_range(imx662->vblank,
+					 vblank_min,
+					 IMX662_VMAX_MAX * frames - height,
+					 frames, vblank_min);
+		/*
+		 * A frame interval set by the user survives format changes.
+		 * Also clamps the exposures to the new frame.
+		 */
+		__v4l2_ctrl_s_ctrl(imx662->vblank,
+				   imx662_interval_to_vblank(imx662, &interval));
+	}
+	/* The notifier skips an unchanged VBLANK, the height may still differ */
+	if (imx662->exposure && imx662->vblank)
+		imx662_update_exposure_range(imx662);
+	if (imx662->short_exposure)
+		v4l2_ctrl_activate(imx662->short_exposure, mode->dol);
+
+	imx662->frame_interval = interval;
+}
+
+static int imx662_enum_frame_interval(struct v4l2_subdev *sd,
+				      struct v4l2_subdev_state *sd_state,
+				      struct v4l2_subdev_frame_interval_enum *fie)
+{
+	struct imx662 *imx662 = to_imx662(sd);
+	const struct imx662_mode *mode = NULL;
+	unsigned int i;
+	u8 bpp = 0;
+
+	/* Only the fastest rate is reported, slower ones come from VBLANK */
+	if (fie->pad != 0 || fie->index > 0)
+		return -EINVAL;
+
+	for (i = 0; i < IMX662_NUM_FORMATS; i++)
+		if (imx662->formats[i].code == fie->code)
+			bpp = imx662->formats[i].bpp;
+
+	if (!bpp)
+		return -EINVAL;
+
+	for (i = 0; i < IMX662_NUM_MODES; i++) {
+		if (imx662_mode_supported(&imx662_modes[i], bpp) &&
+		    imx662_modes[i].width == fie->width &&
+		    imx662_modes[i].height == fie->height) {
+			mode = &imx662_modes[i];
+			break;
+		}
+	}
+
+	if (!mode)
+		return -EINVAL;
+
+	starvis2_timing_to_interval(imx662_hmax_min(imx662, mode, mode->width,
+						    bpp),
+				    imx662_vmax_min(mode, bpp) *
+				    imx662_mode_frames(mode),
+				    IMX662_HMAX_CLOCK, &fie->interval);
+
+	return 0;
+}
+
+static int imx662_g_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
 {
-	return 148500000;
+	struct imx662 *imx662 = to_imx662(sd);
+
+	if (fi->pad != 0)
+		return -EINVAL;
+
+	mutex_lock(&imx662->lock);
+	imx662_get_frame_interval(imx662, &fi->interval);
+	mutex_unlock(&imx662->lock);
+
+	return 0;
+}
+
+/*
+ * Only VMAX is solved for the interval, the line length stays at the value
+ * chosen through HBLANK. The interval is remembered and applied again when
+ * the format or crop changes the frame limits.
+ */
+static int imx662_s_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct imx662 *imx662 = to_imx662(sd);
+	int ret;
+
+	if (fi->pad != 0)
+		return -EINVAL;
+
+	mutex_lock(&imx662->lock);
+
+	/* The exposure cluster clamps the exposures to the new frame */
+	ret = __v4l2_ctrl_s_ctrl(imx662->vblank,
+				 imx662_interval_to_vblank(imx662,
+							   &fi->interval));
+	if (!ret)
+		imx662->frame_interval = fi->interval;
+
+	imx662_get_frame_interval(imx662, &fi->interval);
+
+	mutex_unlock(&imx662->lock);
+
+	return ret;
 }
 
 static int imx662_set_fmt(struct v4l2_subdev *sd,
@@ -635,17 +1218,12 @@ static int imx662_set_fmt(struct v4l2_subdev *sd,
 	struct imx662 *imx662 = to_imx662(sd);
 	const struct imx662_mode *mode;
 	struct v4l2_mbus_framefmt *format;
+	struct v4l2_rect *crop;
 	unsigned int i;
+	u32 frames;
 
 	mutex_lock(&imx662->lock);
 
-	mode = v4l2_find_nearest_size(imx662_modes, IMX662_NUM_MODES,
-				      width, height,
-				      fmt->format.width, fmt->format.height);
-
-	fmt->format.width = mode->width;
-	fmt->format.height = mode->height;
-
 	for (i = 0; i < IMX662_NUM_FORMATS; i++)
 		if (imx662->formats[i].code == fmt->format.code)
 			break;
@@ -653,6 +1231,32 @@ static int imx662_set_fmt(struct v4l2_subdev *sd,
 	if (i >= IMX662_NUM_FORMATS)
 		i = 0;
 
+	mode = imx662_find_mode(imx662->formats[i].bpp,
+				fmt->format.width, fmt->format.height);
+	frames = imx662_mode_frames(mode);
+
+	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
+		format = v4l2_subdev_get_try_format(sd, sd_state, fmt->pad);
+		crop = v4l2_subdev_get_try_crop(sd, sd_state, fmt->pad);
+	} else {
+		format = &imx662->current_format;
+		crop = &imx662->crop;
+	}
+
+	/*
+	 * A format matching the current crop rectangle at the line interleave
+	 * of the nearest mode keeps the window, anything else selects the
+	 * readout window of that mode. Binned modes always read the full
+	 * array.
+	 */
+	if (mode->binning > 1 ||
+	    fmt->format.width != crop->width / mode->binning ||
+	    fmt->format.height != crop->height / mode->binning * frames)
+		*crop = mode->crop;
+
+	fmt->format.width = crop->width / mode->binning;
+	fmt->format.height = crop->height / mode->binning * frames;
+
 	fmt->format.code = imx662->formats[i].code;
 	fmt->format.field = V4L2_FIELD_NONE;
 	fmt->format.colorspace = V4L2_COLORSPACE_RAW;
@@ -664,44 +1268,14 @@ static int imx662_set_fmt(struct v4l2_subdev *sd,
 	fmt->format.xfer_func =
 		V4L2_MAP_XFER_FUNC_DEFAULT(fmt->format.colorspace);
 
-	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-		format = v4l2_subdev_get_try_format(sd, sd_state, fmt->pad);
-	} else {
-		format = &imx662->current_format;
+	*format = fmt->format;
+
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
 		imx662->current_mode = mode;
 		imx662->bpp = imx662->formats[i].bpp;
-
-		if (imx662->pixel_rate)
-			__v4l2_ctrl_s_ctrl_int64(imx662->pixel_rate,
-						 imx662_calc_pixel_rate(imx662));
-
-		if (imx662->hblank) {
-			__v4l2_ctrl_modify_range(imx662->hblank,
-						 mode->hmax - mode->width,
-						 IMX662_HMAX_MAX - mode->width,
-						 1, mode->hmax - mode->width);
-			__v4l2_ctrl_s_ctrl(imx662->hblank,
-					   mode->hmax - mode->width);
-		}
-		if (imx662->vblank) {
-			__v4l2_ctrl_modify_range(imx662->vblank,
-						 mode->vmax - mode->height,
-						 IMX662_VMAX_MAX - mode->height,
-						 1,
-						 mode->vmax - mode->height);
-			__v4l2_ctrl_s_ctrl(imx662->vblank,
-					   mode->vmax - mode->height);
-		}
-		if (imx662->exposure)
-			__v4l2_ctrl_modify_range(imx662->exposure,
-						 IMX662_EXPOSURE_MIN,
-						 mode->vmax - 2,
-						 IMX662_EXPOSURE_STEP,
-						 mode->vmax - 2);
+		imx662_update_framing(imx662);
 	}
 
-	*format = fmt->format;
-
 	mutex_unlock(&imx662->lock);
 
 	return 0;
@@ -716,6 +1290,12 @@ static int imx662_entity_init_cfg(struct v4l2_subdev *subdev,
 	fmt.format.width = 1936;
 	fmt.format.height = 1100;
 
+	if (sd_state)
+		*v4l2_subdev_get_try_crop(subdev, sd_state, 0) =
+			imx662_modes[0].crop;
+	else
+		to_imx662(subdev)->crop = imx662_modes[0].crop;
+
 	imx662_set_fmt(subdev, sd_state, &fmt);
 
 	return 0;
@@ -723,34 +1303,67 @@ static int imx662_entity_init_cfg(struct v4l2_subdev *subdev,
 
 static int imx662_write_current_format(struct imx662 *imx662)
 {
-	u8 ad_md_bit;
+	u8 ad_bit, md_bit;
 	int ret;
 
 	switch (imx662->current_format.code) {
 	case MEDIA_BUS_FMT_SRGGB10_1X10:
 	case MEDIA_BUS_FMT_Y10_1X10:
-		ad_md_bit = 0x00;
+		ad_bit = 0x00;
+		md_bit = 0x00;
 		break;
 	case MEDIA_BUS_FMT_SRGGB12_1X12:
 	case MEDIA_BUS_FMT_Y12_1X12:
-		ad_md_bit = 0x01;
+		ad_bit = 0x01;
+		md_bit = 0x01;
+		break;
+	case MEDIA_BUS_FMT_SRGGB16_1X16:
+	case MEDIA_BUS_FMT_Y16_1X16:
+		/* Clear HDR combines two 12-bit conversions */
+		ad_bit = 0x01;
+		md_bit = 0x03;
 		break;
 	default:
 		dev_err(imx662->dev, "Unknown pixel format\n");
 		return -EINVAL;
 	}
 
-	ret = imx662_write_reg(imx662, IMX662_ADBIT, ad_md_bit);
+	ret = starvis2_write(&imx662->core, IMX662_ADBIT, ad_bit);
 	if (ret < 0)
 		return ret;
 
-	ret = imx662_write_reg(imx662, IMX662_MDBIT, ad_md_bit);
+	ret = starvis2_write(&imx662->core, IMX662_MDBIT, md_bit);
 	if (ret < 0)
 		return ret;
 
 	return 0;
 }
 
+/* Select normal, DOL or Clear HDR readout */
+static int imx662_write_hdr_mode(struct imx662 *imx662)
+{
+	bool clear_hdr = imx662->bpp == 16;
+	u8 wdmode = IMX662_WDMODE_NORMAL;
+	int ret;
+
+	if (clear_hdr)
+		wdmode = IMX662_WDMODE_CLEAR_HDR;
+	else if (imx662->current_mode->dol)
+		wdmode = IMX662_WDMODE_DOL;
+
+	ret = starvis2_write(&imx662->core, IMX662_WDMODE, wdmode);
+	if (!ret)
+		ret = starvis2_write(&imx662->core, IMX662_HDR_CFG0, clear_hdr ?
+				     IMX662_HDR_CFG0_CLEAR_HDR :
+				     IMX662_HDR_CFG0_NORMAL);
+	if (!ret)
+		ret = starvis2_write(&imx662->core, IMX662_HDR_CFG1, clear_hdr ?
+				     IMX662_HDR_CFG1_CLEAR_HDR :
+				     IMX662_HDR_CFG1_NORMAL);
+
+	return ret;
+}
+
 static const struct v4l2_rect *
 __imx662_get_pad_crop(struct imx662 *imx662,
 		      struct v4l2_subdev_state *sd_state,
@@ -760,7 +1373,7 @@ __imx662_get_pad_crop(struct imx662 *imx662,
 	case V4L2_SUBDEV_FORMAT_TRY:
 		return v4l2_subdev_get_try_crop(&imx662->sd, sd_state, pad);
 	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &imx662->current_mode->crop;
+		return &imx662->crop;
 	}
 
 	return NULL;
@@ -803,24 +1416,124 @@ static int imx662_get_selection(struct v4l2_subdev *sd,
 	return -EINVAL;
 }
 
+static void imx662_adjust_crop(struct v4l2_rect *r)
+{
+	r->width = clamp_t(u32, ALIGN_DOWN(r->width, IMX662_CROP_WIDTH_ALIGN),
+			   IMX662_CROP_MIN_WIDTH, IMX662_PIXEL_ARRAY_WIDTH);
+	r->height = clamp_t(u32, ALIGN_DOWN(r->height, IMX662_CROP_HEIGHT_ALIGN),
+			    IMX662_CROP_MIN_HEIGHT, IMX662_PIXEL_ARRAY_HEIGHT);
+
+	r->left = clamp_t(s32, r->left, IMX662_PIXEL_ARRAY_LEFT,
+			  IMX662_PIXEL_ARRAY_LEFT + IMX662_PIXEL_ARRAY_WIDTH -
+			  r->width);
+	r->left = ALIGN_DOWN(r->left - IMX662_PIXEL_ARRAY_LEFT,
+			     IMX662_CROP_LEFT_ALIGN) + IMX662_PIXEL_ARRAY_LEFT;
+	r->top = clamp_t(s32, r->top, IMX662_PIXEL_ARRAY_TOP,
+			 IMX662_PIXEL_ARRAY_TOP + IMX662_PIXEL_ARRAY_HEIGHT -
+			 r->height);
+	r->top = ALIGN_DOWN(r->top - IMX662_PIXEL_ARRAY_TOP,
+			    IMX662_CROP_TOP_ALIGN) + IMX662_PIXEL_ARRAY_TOP;
+}
+
+static int imx662_set_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_state *sd_state,
+				struct v4l2_subdev_selection *sel)
+{
+	struct imx662 *imx662 = to_imx662(sd);
+	struct v4l2_mbus_framefmt *format;
+	struct v4l2_rect *crop;
+	u32 binning, frames;
+	int ret = 0;
+
+	if (sel->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	imx662_adjust_crop(&sel->r);
+
+	mutex_lock(&imx662->lock);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY) {
+		crop = v4l2_subdev_get_try_crop(sd, sd_state, sel->pad);
+		format = v4l2_subdev_get_try_format(sd, sd_state, sel->pad);
+		binning = crop->width > format->width ? 2 : 1;
+		frames = format->height * binning > crop->height ? 2 : 1;
+	} else {
+		if (imx662->streaming) {
+			ret = -EBUSY;
+			goto unlock;
+		}
+		crop = &imx662->crop;
+		format = &imx662->current_format;
+		binning = imx662->current_mode->binning;
+		frames = imx662_mode_frames(imx662->current_mode);
+	}
+
+	/* Windowing is not combined with binning, which reads the full array */
+	if (binning > 1)
+		sel->r = *crop;
+
+	*crop = sel->r;
+	format->width = crop->width / binning;
+	format->height = crop->height / binning * frames;
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		imx662_update_framing(imx662);
+
+unlock:
+	mutex_unlock(&imx662->lock);
+
+	return ret;
+}
+
+/* Program the readout window, all-pixel mode is used for the full array */
+static int imx662_write_crop(struct imx662 *imx662)
+{
+	const struct v4l2_rect *crop = &imx662->crop;
+	int ret;
+
+	if (crop->width == IMX662_PIXEL_ARRAY_WIDTH &&
+	    crop->height == IMX662_PIXEL_ARRAY_HEIGHT)
+		return starvis2_write(&imx662->core, IMX662_WINMODE,
+				      IMX662_WINMODE_ALL);
+
+	ret = starvis2_write(&imx662->core, IMX662_WINMODE,
+			     IMX662_WINMODE_CROP);
+	if (!ret)
+		ret = starvis2_write_multi(&imx662->core, IMX662_PIX_HST, 2,
+					   crop->left - IMX662_PIXEL_ARRAY_LEFT);
+	if (!ret)
+		ret = starvis2_write_multi(&imx662->core, IMX662_PIX_HWIDTH, 2,
+					   crop->width);
+	if (!ret)
+		ret = starvis2_write_multi(&imx662->core, IMX662_PIX_VST, 2,
+					   crop->top - IMX662_PIXEL_ARRAY_TOP);
+	if (!ret)
+		ret = starvis2_write_multi(&imx662->core, IMX662_PIX_VWIDTH, 2,
+					   crop->height);
+
+	return ret;
+}
+
 /* Start streaming */
 static int imx662_start_streaming(struct imx662 *imx662)
 {
+	ktime_t start = ktime_get();
+	ktime_t mode_start;
 	int ret;
 
 	/* Set init register settings */
-	ret = imx662_set_register_array(imx662, imx662_global_settings,
-					ARRAY_SIZE(imx662_global_settings));
+	ret = starvis2_write_table(&imx662->core, imx662_global_settings,
+				   ARRAY_SIZE(imx662_global_settings));
 	if (ret < 0) {
 		dev_err(imx662->dev, "Could not set init registers\n");
 		return ret;
 	}
-pr_err("write INCK_SEL with %02x\n", imx662->inck_sel);
-	ret = imx662_write_reg(imx662, IMX662_INCK_SEL, imx662->inck_sel);
+	ret = starvis2_write(&imx662->core, IMX662_INCK_SEL, imx662->inck_sel);
 	if (ret < 0)
 		return ret;
 
 	/* Apply the register values related to current frame format */
+	mode_start = ktime_get();
 	ret = imx662_write_current_format(imx662);
 	if (ret < 0) {
 		dev_err(imx662->dev, "Could not set frame format\n");
@@ -828,41 +1541,67 @@ pr_err("write INCK_SEL with %02x\n", imx662->inck_sel);
 	}
 
 	/* Apply default values of current mode */
-	ret = imx662_set_register_array(imx662,
-					imx662->current_mode->mode_data,
-					imx662->current_mode->mode_data_size);
+	ret = starvis2_write_table(&imx662->core,
+				   imx662->current_mode->mode_data,
+				   imx662->current_mode->mode_data_size);
 	if (ret < 0) {
 		dev_err(imx662->dev, "Could not set current mode\n");
 		return ret;
 	}
 
+	ret = imx662_write_crop(imx662);
+	if (ret < 0) {
+		dev_err(imx662->dev, "Could not set readout window\n");
+		return ret;
+	}
+
+	ret = imx662_write_hdr_mode(imx662);
+	if (ret < 0) {
+		dev_err(imx662->dev, "Could not set HDR mode\n");
+		return ret;
+	}
+
+	starvis2_stats_update(mode_start,
+			      &imx662->core.stats.mode_switch_last_us,
+			      &imx662->core.stats.mode_switch_max_us);
+	starvis2_log_timeline(&imx662->core, start, "mode registers written");
+
 	/* Apply lane config registers of current mode */
-	ret = imx662_write_reg(imx662, IMX662_CSI_LANE_MODE,
-			       imx662->nlanes == 2 ? 0x01 : 0x03);
+	ret = starvis2_write(&imx662->core, IMX662_CSI_LANE_MODE,
+			     imx662->nlanes == 2 ? 0x01 : 0x03);
 	if (ret < 0)
 		return ret;
 
-	ret = imx662_write_reg(imx662, IMX662_LANE_RATE,
-			       imx662->nlanes == 2 ? IMX662_LANE_RATE_1188 :
-						     IMX662_LANE_RATE_594);
+	ret = starvis2_write(&imx662->core, IMX662_LANE_RATE,
+			     imx662_lane_rates[imx662->link_freq_idx]);
 	if (ret < 0)
 		return ret;
 
 	/* Apply customized values from user */
-	ret = v4l2_ctrl_handler_setup(imx662->sd.ctrl_handler);
+	ret = __v4l2_ctrl_handler_setup(imx662->sd.ctrl_handler);
 	if (ret) {
 		dev_err(imx662->dev, "Could not sync v4l2 controls\n");
 		return ret;
 	}
 
-	ret = imx662_write_reg(imx662, IMX662_STANDBY, 0x00);
+	starvis2_log_timeline(&imx662->core, start, "controls written");
+
+	ret = starvis2_write(&imx662->core, IMX662_STANDBY, 0x00);
 	if (ret < 0)
 		return ret;
 
 	msleep(30);
 
 	/* Start streaming */
-	return imx662_write_reg(imx662, IMX662_XMSTA, 0x00);
+	ret = starvis2_write(&imx662->core, IMX662_XMSTA, 0x00);
+
+	starvis2_log_timeline(&imx662->core, start, "master mode started");
+
+	imx662->core.stats.stream_start_count++;
+	starvis2_stats_update(start, &imx662->core.stats.stream_start_last_us,
+			      &imx662->core.stats.stream_start_max_us);
+
+	return ret;
 }
 
 static int imx662_set_stream(struct v4l2_subdev *sd, int enable)
@@ -870,26 +1609,38 @@ static int imx662_set_stream(struct v4l2_subdev *sd, int enable)
 	struct imx662 *imx662 = to_imx662(sd);
 	int ret = 0;
 
+	mutex_lock(&imx662->lock);
+
+	if (imx662->streaming == enable)
+		goto unlock_and_return;
+
 	if (enable) {
 		ret = pm_runtime_resume_and_get(imx662->dev);
 		if (ret < 0)
 			goto unlock_and_return;
 
 		ret = imx662_start_streaming(imx662);
+		/* Only a complete programming pass leaves the cache in sync */
+		imx662->core.regs_cached = !ret;
 		if (ret) {
 			dev_err(imx662->dev, "Start stream failed\n");
-			pm_runtime_put(imx662->dev);
+			pm_runtime_mark_last_busy(imx662->dev);
+			pm_runtime_put_autosuspend(imx662->dev);
 			goto unlock_and_return;
 		}
 	} else {
 		imx662_stop_streaming(imx662);
-		pm_runtime_put(imx662->dev);
+		pm_runtime_mark_last_busy(imx662->dev);
+		pm_runtime_put_autosuspend(imx662->dev);
 	}
+	imx662->streaming = enable;
+
 	/* vflip and hflip cannot change during streaming */
 	__v4l2_ctrl_grab(imx662->vflip, enable);
 	__v4l2_ctrl_grab(imx662->hflip, enable);
 
 unlock_and_return:
+	mutex_unlock(&imx662->lock);
 
 	return ret;
 }
@@ -928,6 +1679,9 @@ static int imx662_power_on(struct device *dev)
 	gpiod_set_value_cansleep(imx662->rst_gpio, 0);
 	usleep_range(30000, 31000);
 
+	/* A failed restore only costs a full reprogramming at stream start */
+	starvis2_power_up(&imx662->core);
+
 	return 0;
 }
 
@@ -936,6 +1690,8 @@ static int imx662_power_off(struct device *dev)
 	struct v4l2_subdev *sd = dev_get_drvdata(dev);
 	struct imx662 *imx662 = to_imx662(sd);
 
+	starvis2_power_down(&imx662->core);
+
 	clk_disable_unprepare(imx662->xclk);
 	gpiod_set_value_cansleep(imx662->rst_gpio, 1);
 	regulator_bulk_disable(IMX662_NUM_SUPPLIES, imx662->supplies);
@@ -954,15 +1710,19 @@ static const struct v4l2_subdev_core_ops imx662_core_ops = {
 
 static const struct v4l2_subdev_video_ops imx662_video_ops = {
 	.s_stream = imx662_set_stream,
+	.g_frame_interval = imx662_g_frame_interval,
+	.s_frame_interval = imx662_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops imx662_pad_ops = {
 	.init_cfg = imx662_entity_init_cfg,
 	.enum_mbus_code = imx662_enum_mbus_code,
 	.enum_frame_size = imx662_enum_frame_size,
+	.enum_frame_interval = imx662_enum_frame_interval,
 	.get_fmt = imx662_get_fmt,
 	.set_fmt = imx662_set_fmt,
 	.get_selection = imx662_get_selection,
+	.set_selection = imx662_set_selection,
 };
 
 static const struct v4l2_subdev_ops imx662_subdev_ops = {
@@ -976,25 +1736,19 @@ static const struct media_entity_operations imx662_subdev_entity_ops = {
 };
 
 /*
- * Returns 0 if all link frequencies used by the driver for the given number
- * of MIPI data lanes are mentioned in the device tree, or the value of the
- * first missing frequency otherwise.
+ * Select the fastest supported link frequency listed in the device tree.
+ * Returns the index into imx662_link_freqs, or -EINVAL if none is usable.
  */
-static s64 imx662_check_link_freqs(const struct imx662 *imx662,
-				   const struct v4l2_fwnode_endpoint *ep)
+static int imx662_select_link_freq(const struct v4l2_fwnode_endpoint *ep)
 {
-	int i, j;
-	const s64 *freqs = imx662_link_freqs_ptr(imx662);
-	int freqs_count = imx662_link_freqs_num(imx662);
+	unsigned int i, j;
 
-	for (i = 0; i < freqs_count; i++) {
+	for (i = 0; i < ARRAY_SIZE(imx662_link_freqs); i++)
 		for (j = 0; j < ep->nr_of_link_frequencies; j++)
-			if (freqs[i] == ep->link_frequencies[j])
-				break;
-		if (j == ep->nr_of_link_frequencies)
-			return freqs[i];
-	}
-	return 0;
+			if (imx662_link_freqs[i] == ep->link_frequencies[j])
+				return i;
+
+	return -EINVAL;
 }
 
 static const struct of_device_id imx662_of_match[] = {
@@ -1017,7 +1771,6 @@ static int imx662_probe(struct i2c_client *client)
 	struct v4l2_ctrl *ctrl;
 	struct imx662 *imx662;
 	u32 xclk_freq;
-	s64 fq;
 	int ret;
 
 	imx662 = devm_kzalloc(dev, sizeof(*imx662), GFP_KERNEL);
@@ -1025,11 +1778,9 @@ static int imx662_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	imx662->dev = dev;
-	imx662->regmap = devm_regmap_init_i2c(client, &imx662_regmap_config);
-	if (IS_ERR(imx662->regmap)) {
-		dev_err(dev, "Unable to initialize I2C\n");
-		return -ENODEV;
-	}
+	ret = starvis2_init(&imx662->core, client);
+	if (ret)
+		return ret;
 
 	match = of_match_device(imx662_of_match, dev);
 	if (!match)
@@ -1068,13 +1819,15 @@ static int imx662_probe(struct i2c_client *client)
 		goto free_err;
 	}
 
-	/* Check that link frequences for all the modes are in device tree */
-	fq = imx662_check_link_freqs(imx662, &ep);
-	if (fq) {
-		dev_err(dev, "Link frequency of %lld is not supported\n", fq);
-		ret = -EINVAL;
+	ret = imx662_select_link_freq(&ep);
+	if (ret < 0) {
+		dev_err(dev, "No supported link frequency in DT\n");
 		goto free_err;
 	}
+	imx662->link_freq_idx = ret;
+
+	dev_dbg(dev, "Using link frequency %lld\n",
+		imx662_link_freqs[imx662->link_freq_idx]);
 
 	/* get system clock (xclk) */
 	imx662->xclk = devm_clk_get(dev, "xclk");
@@ -1144,17 +1897,23 @@ static int imx662_probe(struct i2c_client *client)
 	 */
 	imx662_entity_init_cfg(&imx662->sd, NULL);
 
-	v4l2_ctrl_handler_init(&imx662->ctrls, 11);
+	v4l2_ctrl_handler_init(&imx662->ctrls, 13);
+	/* Serialise controls with format, selection and stream changes */
+	imx662->ctrls.lock = &imx662->lock;
 
-	v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
-			  V4L2_CID_ANALOGUE_GAIN, 0, 100, 1, 0);
+	imx662_init_gain_table(imx662);
+	imx662->gain = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
+					 V4L2_CID_ANALOGUE_GAIN,
+					 IMX662_GAIN_MIN, IMX662_GAIN_MAX,
+					 IMX662_GAIN_STEP, IMX662_GAIN_DEFAULT);
+	imx662->hcg = v4l2_ctrl_new_custom(&imx662->ctrls, &imx662_hcg_ctrl,
+					   NULL);
 
+	/* The blanking limits are set by imx662_update_framing() */
 	mode = imx662->current_mode;
 	imx662->hblank = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
-					   V4L2_CID_HBLANK,
-					   mode->hmax - mode->width,
-					   IMX662_HMAX_MAX - mode->width, 1,
-					   mode->hmax - mode->width);
+					   V4L2_CID_HBLANK, 0, IMX662_HMAX_MAX,
+					   1, 0);
 
 	imx662->vblank = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
 					   V4L2_CID_VBLANK,
@@ -1165,9 +1924,15 @@ static int imx662_probe(struct i2c_client *client)
 	imx662->exposure = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
 					     V4L2_CID_EXPOSURE,
 					     IMX662_EXPOSURE_MIN,
-					     mode->vmax - 2,
+					     mode->vmax -
+					     IMX662_EXPOSURE_OFFSET,
 					     IMX662_EXPOSURE_STEP,
-					     mode->vmax - 2);
+					     mode->vmax -
+					     IMX662_EXPOSURE_OFFSET);
+
+	imx662->short_exposure =
+		v4l2_ctrl_new_custom(&imx662->ctrls,
+				     &imx662_short_exposure_ctrl, NULL);
 
 	imx662->hflip = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
 					  V4L2_CID_HFLIP, 0, 1, 1, 0);
@@ -1176,11 +1941,15 @@ static int imx662_probe(struct i2c_client *client)
 
 	ctrl = v4l2_ctrl_new_int_menu(&imx662->ctrls, &imx662_ctrl_ops,
 				      V4L2_CID_LINK_FREQ,
-				      imx662_link_freqs_num(imx662) - 1, 0,
-				      imx662_link_freqs_ptr(imx662));
+				      ARRAY_SIZE(imx662_link_freqs) - 1,
+				      imx662->link_freq_idx,
+				      imx662_link_freqs);
 	if (ctrl)
 		ctrl->flags |= V4L2_CTRL_FLAG_READ_ONLY;
 
+	v4l2_ctrl_cluster(5, &imx662->exposure);
+	v4l2_ctrl_notify(imx662->vblank, imx662_vblank_notify, imx662);
+
 	imx662->pixel_rate = v4l2_ctrl_new_std(&imx662->ctrls, &imx662_ctrl_ops,
 					       V4L2_CID_PIXEL_RATE,
 					       1, INT_MAX, 1,
@@ -1235,11 +2004,15 @@ static int imx662_probe(struct i2c_client *client)
 	}
 
 	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, IMX662_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
 	pm_runtime_enable(dev);
 	pm_runtime_idle(dev);
 
 	v4l2_fwnode_endpoint_free(&ep);
 
+	starvis2_debugfs_init(&imx662->core, "imx662");
+
 	return 0;
 
 free_entity:
@@ -1258,12 +2031,14 @@ static void imx662_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct imx662 *imx662 = to_imx662(sd);
 
+	starvis2_debugfs_remove(&imx662->core);
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 
 	mutex_destroy(&imx662->lock);
 
+	pm_runtime_dont_use_autosuspend(imx662->dev);
 	pm_runtime_disable(imx662->dev);
 	if (!pm_runtime_status_suspended(imx662->dev))
 		imx662_power_off(imx662->dev);
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Common core of the Sony STARVIS 2 sensor drivers
+ *
+ * The IMX585 and IMX662 share their control interface: 16-bit register
+ * addresses with 8-bit auto-incrementing data, multi-byte values stored
+ * least significant byte first, a REGHOLD register latching updates at the
+ * next frame and an HMAX/VMAX frame timing counted in a fixed clock. This
+ * module provides the register engine, the timing conversions and the
+ * debugfs counters used by both drivers.
+ *
+ * Copyright (C) 2024 OCTOPUS CINEMA
+ */
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/gcd.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+
+#include "sony-starvis2.h"
+
+/*
+ * Standby, hold and master start sequence the sensor, they must never be
+ * replayed by regcache_sync() or skipped as already written.
+ */
+static bool starvis2_volatile_reg(struct device *dev, unsigned int reg)
+{
+	return reg >= STARVIS2_STANDBY && reg <= STARVIS2_XMSTA;
+}
+
+static const struct regmap_config starvis2_regmap_config = {
+	.reg_bits = 16,
+	.val_bits = 8,
+	.volatile_reg = starvis2_volatile_reg,
+	.cache_type = REGCACHE_RBTREE,
+};
+
+/*
+ * The sensor is off until starvis2_power_up(), writes made before then are
+ * only cached and restored at power up.
+ */
+int starvis2_init(struct starvis2 *core, struct i2c_client *client)
+{
+	core->dev = &client->dev;
+	core->regmap = devm_regmap_init_i2c(client, &starvis2_regmap_config);
+	if (IS_ERR(core->regmap)) {
+		dev_err(core->dev, "Unable to initialize I2C\n");
+		return PTR_ERR(core->regmap);
+	}
+
+	regcache_cache_only(core->regmap, true);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(starvis2_init);
+
+static void starvis2_count_transfer(struct starvis2 *core, unsigned int len)
+{
+	core->stats.i2c_transfers++;
+	core->stats.i2c_bytes += sizeof(u16) + len;
+}
+
+/*
+ * Read a register the sensor reports, such as the chip ID. The cache is
+ * bypassed so the value comes from the sensor and is never restored by
+ * regcache_sync(). Only used while no other writer is active.
+ */
+int starvis2_read(struct starvis2 *core, u16 addr, u8 *val)
+{
+	unsigned int regval;
+	int ret;
+
+	regcache_cache_bypass(core->regmap, true);
+	ret = regmap_read(core->regmap, addr, &regval);
+	regcache_cache_bypass(core->regmap, false);
+	starvis2_count_transfer(core, 1);
+	if (ret) {
+		dev_err(core->dev, "I2C read failed for addr: %x\n", addr);
+		return ret;
+	}
+
+	*val = regval & 0xff;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(starvis2_read);
+
+int starvis2_write(struct starvis2 *core, u16 addr, u8 val)
+{
+	int ret;
+
+	ret = regmap_write(core->regmap, addr, val);
+	starvis2_count_transfer(core, 1);
+	if (ret)
+		dev_err(core->dev, "I2C write failed for addr: %x\n", addr);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(starvis2_write);
+
+/* Write a multi-byte value, least significant byte first */
+int starvis2_write_multi(struct starvis2 *core, u16 addr, unsigned int len,
+			 u32 val)
+{
+	u8 buf[4];
+	unsigned int i;
+	int ret;
+
+	if (len > ARRAY_SIZE(buf))
+		return -EINVAL;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (u8)(val >> (i * 8));
+
+	ret = regmap_raw_write(core->regmap, addr, buf, len);
+	starvis2_count_transfer(core, len);
+	if (ret)
+		dev_err(core->dev, "I2C write failed for addr: %x\n", addr);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(starvis2_write_multi);
+
+/* Look a register up in the cache, a miss never falls back to the bus */
+static bool starvis2_cached(struct starvis2 *core, u16 addr,
+			    unsigned int *val)
+{
+	int ret;
+
+	regcache_cache_only(core->regmap, true);
+	ret = regmap_read(core->regmap, addr, val);
+	regcache_cache_only(core->regmap, false);
+
+	return !ret;
+}
+
+/*
+ * Write a register table. Runs of consecutive addresses are coalesced into
+ * auto-increment bursts. While the cache mirrors the sensor, registers that
+ * already hold the requested value are skipped when they start a run.
+ */
+int starvis2_write_table(struct starvis2 *core,
+			 const struct starvis2_reg *regs, unsigned int num)
+{
+	u8 burst[STARVIS2_MAX_BURST];
+	unsigned int i = 0, len, val;
+	u16 start;
+	int ret;
+
+	while (i < num) {
+		if (core->regs_cached &&
+		    starvis2_cached(core, regs[i].address, &val) &&
+		    val == regs[i].val) {
+			i++;
+			continue;
+		}
+
+		start = regs[i].address;
+		len = 0;
+		while (i < num && len < STARVIS2_MAX_BURST &&
+		       regs[i].address == start + len)
+			burst[len++] = regs[i++].val;
+
+		ret = regmap_raw_write(core->regmap, start, burst, len);
+		starvis2_count_transfer(core, len);
+		if (ret) {
+			dev_err(core->dev,
+				"I2C write failed for addr: %x len: %u\n",
+				start, len);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(starvis2_write_table);
+
+/* Registers written while held are latched together at the next frame */
+int starvis2_hold(struct starvis2 *core, bool hold)
+{
+	return starvis2_write(core, STARVIS2_REGHOLD, hold ? 0x01 : 0x00);
+}
+EXPORT_SYMBOL_GPL(starvis2_hold);
+
+/*
+ * Restore everything programmed before the power cycle in bursts, so the
+ * next stream start only writes registers that differ. Called once the
+ * sensor accepts I2C after reset.
+ */
+int starvis2_power_up(struct starvis2 *core)
+{
+	int ret;
+
+	regcache_cache_only(core->regmap, false);
+	ret = regcache_sync(core->regmap);
+	if (ret)
+		dev_warn(core->dev, "Failed to restore registers: %d\n", ret);
+	core->regs_cached = !ret;
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(starvis2_power_up);
+
+/* The sensor loses its registers, keep them in the cache only */
+void starvis2_power_down(struct starvis2 *core)
+{
+	core->regs_cached = false;
+	regcache_cache_only(core->regmap, true);
+	regcache_mark_dirty(core->regmap);
+}
+EXPORT_SYMBOL_GPL(starvis2_power_down);
+
+/*
+ * Frame period of HMAX clocks per line times the lines of the frame, as a
+ * fraction of seconds for a timing counted in the given clock.
+ */
+void starvis2_timing_to_interval(u32 hmax, u32 lines, u32 clock,
+				 struct v4l2_fract *interval)
+{
+	u64 num = (u64)hmax * lines;
+	u64 quot = num;
+	u32 den = clock;
+	u32 div;
+
+	div = gcd(den, do_div(quot, den));
+	do_div(num, div);
+	den /= div;
+
+	/* Only frame periods beyond a minute overflow the fraction */
+	while (num > U32_MAX) {
+		num >>= 1;
+		den >>= 1;
+	}
+
+	interval->numerator = num;
+	interval->denominator = den;
+}
+EXPORT_SYMBOL_GPL(starvis2_timing_to_interval);
+
+void starvis2_stats_update(ktime_t start, u64 *last_us, u64 *max_us)
+{
+	*last_us = ktime_us_delta(ktime_get(), start);
+	*max_us = max(*max_us, *last_us);
+}
+EXPORT_SYMBOL_GPL(starvis2_stats_update);
+
+void starvis2_log_timeline(struct starvis2 *core, ktime_t start,
+			   const char *stage)
+{
+	dev_dbg(core->dev, "stream start: %s at %lld us\n", stage,
+		ktime_us_delta(ktime_get(), start));
+}
+EXPORT_SYMBOL_GPL(starvis2_log_timeline);
+
+void starvis2_debugfs_init(struct starvis2 *core, const char *sensor)
+{
+	struct starvis2_stats *stats = &core->stats;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%s-%s", sensor, dev_name(core->dev));
+	core->debugfs = debugfs_create_dir(name, NULL);
+
+	debugfs_create_u64("i2c_transfers", 0444, core->debugfs,
+			   &stats->i2c_transfers);
+	debugfs_create_u64("i2c_bytes", 0444, core->debugfs,
+			   &stats->i2c_bytes);
+	debugfs_create_u64("stream_start_count", 0444, core->debugfs,
+			   &stats->stream_start_count);
+	debugfs_create_u64("stream_start_last_us", 0444, core->debugfs,
+			   &stats->stream_start_last_us);
+	debugfs_create_u64("stream_start_max_us", 0444, core->debugfs,
+			   &stats->stream_start_max_us);
+	debugfs_create_u64("mode_switch_last_us", 0444, core->debugfs,
+			   &stats->mode_switch_last_us);
+	debugfs_create_u64("mode_switch_max_us", 0444, core->debugfs,
+			   &stats->mode_switch_max_us);
+	debugfs_create_u64("ctrl_write_count", 0444, core->debugfs,
+			   &stats->ctrl_write_count);
+	debugfs_create_u64("ctrl_write_last_us", 0444, core->debugfs,
+			   &stats->ctrl_write_last_us);
+	debugfs_create_u64("ctrl_write_max_us", 0444, core->debugfs,
+			   &stats->ctrl_write_max_us);
+}
+EXPORT_SYMBOL_GPL(starvis2_debugfs_init);
+
+void starvis2_debugfs_remove(struct starvis2 *core)
+{
+	debugfs_remove_recursive(core->debugfs);
+	core->debugfs = NULL;
+}
+EXPORT_SYMBOL_GPL(starvis2_debugfs_remove);
+
+MODULE_AUTHOR("Russell Newman <russellnewman@octopuscinema.com>");
+MODULE_DESCRIPTION("Sony STARVIS 2 sensor common core");
+MODULE_LICENSE("GPL v2");
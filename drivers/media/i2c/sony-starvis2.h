@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Common core of the Sony STARVIS 2 sensor drivers
+ *
+ * Copyright (C) 2024 OCTOPUS CINEMA
+ */
+#ifndef __SONY_STARVIS2_H__
+#define __SONY_STARVIS2_H__
+
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/regmap.h>
+#include <linux/types.h>
+#include <linux/videodev2.h>
+
+/* Sequencing registers, shared by the whole family */
+#define STARVIS2_STANDBY		0x3000
+/* Holds register updates until released */
+#define STARVIS2_REGHOLD		0x3001
+#define STARVIS2_XMSTA			0x3002
+
+/* Longest run of consecutive registers written in one I2C transfer */
+#define STARVIS2_MAX_BURST		32
+
+struct starvis2_reg {
+	u16 address;
+	u8 val;
+};
+
+/*
+ * Bus traffic and latency of the paths that program the sensor. Times are in
+ * microseconds, the counters are read-only in debugfs.
+ * Setting a format only updates controls, so the mode switch time is that of
+ * writing the mode registers at the next stream start.
+ */
+struct starvis2_stats {
+	u64 i2c_transfers;
+	u64 i2c_bytes;
+	u64 stream_start_count;
+	u64 stream_start_last_us;
+	u64 stream_start_max_us;
+	u64 mode_switch_last_us;
+	u64 mode_switch_max_us;
+	u64 ctrl_write_count;
+	u64 ctrl_write_last_us;
+	u64 ctrl_write_max_us;
+};
+
+struct starvis2 {
+	struct device *dev;
+	struct regmap *regmap;
+	/* The register cache mirrors the sensor since the last power on */
+	bool regs_cached;
+
+	/* Bus and latency counters, see starvis2_debugfs_init() */
+	struct starvis2_stats stats;
+	struct dentry *debugfs;
+};
+
+int starvis2_init(struct starvis2 *core, struct i2c_client *client);
+
+int starvis2_read(struct starvis2 *core, u16 addr, u8 *val);
+int starvis2_write(struct starvis2 *core, u16 addr, u8 val);
+int starvis2_write_multi(struct starvis2 *core, u16 addr, unsigned int len,
+			 u32 val);
+int starvis2_write_table(struct starvis2 *core,
+			 const struct starvis2_reg *regs, unsigned int num);
+int starvis2_hold(struct starvis2 *core, bool hold);
+
+int starvis2_power_up(struct starvis2 *core);
+void starvis2_power_down(struct starvis2 *core);
+
+void starvis2_timing_to_interval(u32 hmax, u32 lines, u32 clock,
+				 struct v4l2_fract *interval);
+
+void starvis2_stats_update(ktime_t start, u64 *last_us, u64 *max_us);
+void starvis2_log_timeline(struct starvis2 *core, ktime_t start,
+			   const char *stage);
+void starvis2_debugfs_init(struct starvis2 *core, const char *sensor);
+void starvis2_debugfs_remove(struct starvis2 *core);
+
+#endif /* __SONY_STARVIS2_H__ */
@@ -44,7 +44,11 @@
  * not be able to stream data.
  */
 
+#include <linux/atomic.h>
+#include <linux/bcm2835-unicam.h>
+#include <linux/bitmap.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
@@ -52,12 +56,15 @@
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/kfifo.h>
+#include <linux/llist.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/of_graph.h>
 #include <linux/pinctrl/consumer.h>
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/videodev2.h>
@@ -88,6 +95,47 @@ static int media_controller;
 module_param(media_controller, int, 0644);
 MODULE_PARM_DESC(media_controller, "Use media controller API");
 
+/*
+ * How often the line count interrupt fires within a frame. A buffer queued
+ * after the frame start can only be scheduled from a line count interrupt,
+ * so fewer interrupts mean a late buffer is more likely to miss a frame.
+ */
+enum unicam_lci_policy {
+	/* Every quarter frame, at least 128 lines apart */
+	UNICAM_LCI_QUARTER,
+	/* None, the next buffer is only scheduled at frame start */
+	UNICAM_LCI_NONE,
+	/* Once, half way through the frame */
+	UNICAM_LCI_MID,
+	/* Every sixteenth of the frame, at least 16 lines apart */
+	UNICAM_LCI_DENSE,
+};
+
+static int unicam_set_lci_policy(const char *val,
+				 const struct kernel_param *kp)
+{
+	unsigned int policy;
+	int ret;
+
+	ret = kstrtouint(val, 0, &policy);
+	if (ret)
+		return ret;
+
+	if (policy > UNICAM_LCI_DENSE)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops unicam_lci_policy_ops = {
+	.set = unicam_set_lci_policy,
+	.get = param_get_uint,
+};
+
+static unsigned int lci_policy = UNICAM_LCI_QUARTER;
+module_param_cb(lci_policy, &unicam_lci_policy_ops, &lci_policy, 0644);
+MODULE_PARM_DESC(lci_policy, "Line count interrupts: 0 quarter frame, 1 none, 2 mid frame, 3 dense");
+
 #define unicam_dbg(level, dev, fmt, arg...)	\
 		v4l2_dbg(level, debug, &(dev)->v4l2_dev, fmt, ##arg)
 #define unicam_info(dev, fmt, arg...)	\
@@ -125,6 +173,8 @@ MODULE_PARM_DESC(media_controller, "Use media controller API");
 #define MIN_HEIGHT		16
 /* Default size of the embedded buffer */
 #define UNICAM_EMBEDDED_SIZE	16384
+/* Largest line count interrupt interval UNICAM_LCIE_MASK can hold */
+#define MAX_LINE_INT_FREQ	8191
 
 /*
  * Size of the dummy buffer allocation.
@@ -162,9 +212,14 @@ enum pad_types {
  * @pixelformat: V4L2 pixel format FCC identifier. 0 if n/a.
  * @repacked_fourcc: V4L2 pixel format FCC identifier if the data is expanded
  * out to 16bpp. 0 if n/a.
+ * @packed_fourcc: V4L2 pixel format FCC identifier if the data is repacked
+ * to @packed_depth bits per pixel. 0 if n/a.
+ * @packed_depth: Bits per pixel of @packed_fourcc.
  * @code: V4L2 media bus format code.
  * @depth: Bits per pixel as delivered from the source.
  * @csi_dt: CSI data type.
+ * @decode: DPCM decode mode (UNICAM_DDM_*) applied when the data is expanded
+ *		to @repacked_fourcc. 0 if n/a.
  * @valid_colorspaces: Bitmask of valid colorspaces so that the Media Controller
  *		centric try_fmt can validate the colorspace and pass
  *		v4l2-compliance.
@@ -177,9 +232,12 @@ enum pad_types {
 struct unicam_fmt {
 	u32	fourcc;
 	u32	repacked_fourcc;
+	u32	packed_fourcc;
 	u32	code;
 	u8	depth;
+	u8	packed_depth;
 	u8	csi_dt;
+	u8	decode;
 	u32	valid_colorspaces;
 	u8	check_variants:1;
 	u8	mc_skip:1;
@@ -326,6 +384,7 @@ static const struct unicam_fmt formats[] = {
 		.code		= MEDIA_BUS_FMT_SBGGR10_1X10,
 		.depth		= 10,
 		.csi_dt		= MIPI_CSI2_DT_RAW10,
+		.check_variants = 1,
 		.valid_colorspaces = MASK_CS_RAW,
 	}, {
 		.fourcc		= V4L2_PIX_FMT_SGBRG10P,
@@ -333,6 +392,7 @@ static const struct unicam_fmt formats[] = {
 		.code		= MEDIA_BUS_FMT_SGBRG10_1X10,
 		.depth		= 10,
 		.csi_dt		= MIPI_CSI2_DT_RAW10,
+		.check_variants = 1,
 		.valid_colorspaces = MASK_CS_RAW,
 	}, {
 		.fourcc		= V4L2_PIX_FMT_SGRBG10P,
@@ -340,6 +400,7 @@ static const struct unicam_fmt formats[] = {
 		.code		= MEDIA_BUS_FMT_SGRBG10_1X10,
 		.depth		= 10,
 		.csi_dt		= MIPI_CSI2_DT_RAW10,
+		.check_variants = 1,
 		.valid_colorspaces = MASK_CS_RAW,
 	}, {
 		.fourcc		= V4L2_PIX_FMT_SRGGB10P,
@@ -347,6 +408,52 @@ static const struct unicam_fmt formats[] = {
 		.code		= MEDIA_BUS_FMT_SRGGB10_1X10,
 		.depth		= 10,
 		.csi_dt		= MIPI_CSI2_DT_RAW10,
+		.check_variants = 1,
+		.valid_colorspaces = MASK_CS_RAW,
+	}, {
+	/*
+	 * DPCM compressed Bayer formats. Either stored compressed, or decoded
+	 * inline and expanded to 16bpp or packed to 10bpp. There are no V4L2
+	 * or media bus codes for other compression ratios.
+	 */
+		.fourcc		= V4L2_PIX_FMT_SBGGR10DPCM8,
+		.repacked_fourcc = V4L2_PIX_FMT_SBGGR10,
+		.packed_fourcc	= V4L2_PIX_FMT_SBGGR10P,
+		.code		= MEDIA_BUS_FMT_SBGGR10_DPCM8_1X8,
+		.depth		= 8,
+		.packed_depth	= 10,
+		.csi_dt		= MIPI_CSI2_DT_RAW8,
+		.decode		= UNICAM_DDM_8TO10,
+		.valid_colorspaces = MASK_CS_RAW,
+	}, {
+		.fourcc		= V4L2_PIX_FMT_SGBRG10DPCM8,
+		.repacked_fourcc = V4L2_PIX_FMT_SGBRG10,
+		.packed_fourcc	= V4L2_PIX_FMT_SGBRG10P,
+		.code		= MEDIA_BUS_FMT_SGBRG10_DPCM8_1X8,
+		.depth		= 8,
+		.packed_depth	= 10,
+		.csi_dt		= MIPI_CSI2_DT_RAW8,
+		.decode		= UNICAM_DDM_8TO10,
+		.valid_colorspaces = MASK_CS_RAW,
+	}, {
+		.fourcc		= V4L2_PIX_FMT_SGRBG10DPCM8,
+		.repacked_fourcc = V4L2_PIX_FMT_SGRBG10,
+		.packed_fourcc	= V4L2_PIX_FMT_SGRBG10P,
+		.code		= MEDIA_BUS_FMT_SGRBG10_DPCM8_1X8,
+		.depth		= 8,
+		.packed_depth	= 10,
+		.csi_dt		= MIPI_CSI2_DT_RAW8,
+		.decode		= UNICAM_DDM_8TO10,
+		.valid_colorspaces = MASK_CS_RAW,
+	}, {
+		.fourcc		= V4L2_PIX_FMT_SRGGB10DPCM8,
+		.repacked_fourcc = V4L2_PIX_FMT_SRGGB10,
+		.packed_fourcc	= V4L2_PIX_FMT_SRGGB10P,
+		.code		= MEDIA_BUS_FMT_SRGGB10_DPCM8_1X8,
+		.depth		= 8,
+		.packed_depth	= 10,
+		.csi_dt		= MIPI_CSI2_DT_RAW8,
+		.decode		= UNICAM_DDM_8TO10,
 		.valid_colorspaces = MASK_CS_RAW,
 	}, {
 		.fourcc		= V4L2_PIX_FMT_SBGGR12P,
@@ -474,6 +581,8 @@ static const struct unicam_fmt formats[] = {
 struct unicam_buffer {
 	struct vb2_v4l2_buffer vb;
 	struct list_head list;
+	/* Entry in done_list until the interrupt thread completes it */
+	struct llist_node done;
 };
 
 static inline struct unicam_buffer *to_unicam_buffer(struct vb2_buffer *vb)
@@ -500,10 +609,18 @@ struct unicam_node {
 	struct v4l2_mbus_framefmt m_fmt;
 	/* Buffer queue used in video-buf */
 	struct vb2_queue buffer_queue;
-	/* Queue of filled frames */
-	struct list_head dma_queue;
-	/* IRQ lock for DMA queue */
-	spinlock_t dma_queue_lock;
+	/*
+	 * Buffers queued by userland, waiting to be filled. A single
+	 * producer, single consumer ring: unicam_buffer_queue() advances the
+	 * head under the vb2 queue lock, and the interrupt handler, or stream
+	 * on and off while it can't run for this node, advances the tail. It
+	 * has room for every buffer vb2 can allocate, so it never fills.
+	 */
+	struct unicam_buffer *ring[VB2_MAX_FRAME];
+	unsigned int ring_head;
+	unsigned int ring_tail;
+	/* Buffers returned by the interrupt handler after a repeated FS */
+	struct list_head requeue;
 	/* lock used to access this structure */
 	struct mutex lock;
 	/* Identifies video device for this channel */
@@ -521,6 +638,49 @@ struct unicam_node {
 	dma_addr_t dummy_buf_dma_addr;
 };
 
+#define IRQ_LATENCY_BUCKETS	12
+/* Events the interrupt thread may fall behind by, a power of two */
+#define UNICAM_EVENT_FIFO_SIZE	32
+
+/*
+ * Receiver errors reported in UNICAM_STA and frames lost by each node since
+ * probe, read through debugfs. The counters are only written by the
+ * interrupt handler. The rate window is also restarted at stream on, so it
+ * is kept under irq_window_lock, which also keeps the 64-bit start time
+ * from tearing on 32-bit.
+ */
+struct unicam_stats {
+	/* Image, output and burst FIFO overflows */
+	u32 ifo;
+	u32 ofo;
+	u32 bfo;
+	/* Packet CRC, packet length, sync short and header ECC errors */
+	u32 crce;
+	u32 ple;
+	u32 ssc;
+	u32 hoe;
+	/* Frames written to the dummy buffer as no buffer was queued */
+	u32 dummy_frames[MAX_NODES];
+	/* Frames dropped on a frame end that had no frame start */
+	u32 fe_without_fs[MAX_NODES];
+	/* Frames requeued on a frame start that had no frame end */
+	u32 repeated_fs[MAX_NODES];
+	/* Interrupts in total and over the last complete second */
+	u32 irqs;
+	spinlock_t irq_window_lock;
+	u32 irqs_per_sec;
+	u32 irq_window_count;
+	u64 irq_window_start;
+	/*
+	 * Time spent in the hard interrupt handler. Bucket 0 counts calls
+	 * under 1us and bucket n those under 2^n us, the last one is open.
+	 */
+	u32 irq_latency[IRQ_LATENCY_BUCKETS];
+	u32 irq_latency_max_ns;
+	/* Events lost as the thread was a whole event FIFO behind */
+	u32 events_dropped;
+};
+
 struct unicam_device {
 	struct kref kref;
 
@@ -547,6 +707,11 @@ struct unicam_device {
 	struct v4l2_async_notifier notifier;
 	unsigned int sequence;
 	bool frame_started;
+	/* V4L2_CID_UNICAM_SLICE_LINES, sampled at stream on, 0 if disabled */
+	struct v4l2_ctrl *slice_lines_ctrl;
+	unsigned int slice_lines;
+	/* Line count interrupt interval programmed at stream on, 0 if none */
+	unsigned int line_int_freq;
 
 	/* ptr to  sub device */
 	struct v4l2_subdev *sensor;
@@ -562,10 +727,35 @@ struct unicam_device {
 	unsigned int max_data_lanes;
 	unsigned int active_data_lanes;
 	bool sensor_embedded_data;
+	/* CSI-2 virtual channel and data type of the image stream */
+	u8 image_vc;
+	u8 image_dt;
+	/*
+	 * Entries of formats[] whose media bus code the sensor enumerates,
+	 * rebuilt under sensor_formats_lock once sensor_formats_stale is set.
+	 * The nodes have their own locks and the sensor notifies from any
+	 * context, so the flag is atomic and the bitmap has its own lock.
+	 */
+	struct mutex sensor_formats_lock;
+	DECLARE_BITMAP(sensor_formats, ARRAY_SIZE(formats));
+	atomic_t sensor_formats_stale;
 
 	struct unicam_node node[MAX_NODES];
 	struct v4l2_ctrl_handler ctrl_handler;
 
+	struct unicam_stats stats;
+	struct dentry *debugfs;
+
+	int irq;
+	/*
+	 * Work handed from the hard interrupt handler to its thread: buffers
+	 * to complete, and events to queue in the order they were raised.
+	 * The handler is the only producer and the thread the only consumer,
+	 * so the FIFO needs no lock.
+	 */
+	struct llist_head done_list;
+	DECLARE_KFIFO(events, struct v4l2_event, UNICAM_EVENT_FIFO_SIZE);
+
 	bool mc_api;
 };
 
@@ -644,12 +834,21 @@ static const struct unicam_fmt *find_format_by_code(u32 code)
 	return NULL;
 }
 
-static int check_mbus_format(struct unicam_device *dev,
-			     const struct unicam_fmt *format)
+/*
+ * Enumerate the media bus codes of the sensor once, rather than on every
+ * format lookup. The cache is dropped when the sensor reports a source
+ * change or hands back a code other than the one asked for, as a flip may
+ * change the Bayer order it enumerates.
+ */
+static void unicam_cache_sensor_formats(struct unicam_device *dev)
 {
-	unsigned int i;
+	unsigned int i, j;
 	int ret = 0;
 
+	lockdep_assert_held(&dev->sensor_formats_lock);
+
+	bitmap_zero(dev->sensor_formats, ARRAY_SIZE(formats));
+
 	for (i = 0; !ret && i < MAX_ENUM_MBUS_CODE; i++) {
 		struct v4l2_subdev_mbus_code_enum mbus_code = {
 			.index = i,
@@ -659,40 +858,37 @@ static int check_mbus_format(struct unicam_device *dev,
 
 		ret = v4l2_subdev_call(dev->sensor, pad, enum_mbus_code,
 				       NULL, &mbus_code);
+		if (ret)
+			break;
 
-		if (!ret && mbus_code.code == format->code)
-			return 1;
+		for (j = 0; j < ARRAY_SIZE(formats); j++) {
+			if (formats[j].code == mbus_code.code)
+				__set_bit(j, dev->sensor_formats);
+		}
 	}
-
-	return 0;
 }
 
-static const struct unicam_fmt *find_format_by_pix(struct unicam_device *dev,
-						   u32 pixelformat)
+static inline void unicam_invalidate_sensor_formats(struct unicam_device *dev)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_SIZE(formats); i++) {
-		if (formats[i].fourcc == pixelformat ||
-		    formats[i].repacked_fourcc == pixelformat) {
-			if (formats[i].check_variants &&
-			    !check_mbus_format(dev, &formats[i]))
-				continue;
-			return &formats[i];
-		}
-	}
-
-	return NULL;
+	atomic_set(&dev->sensor_formats_stale, 1);
 }
 
-static unsigned int bytes_per_line(u32 width, const struct unicam_fmt *fmt,
-				   u32 v4l2_fourcc)
+/*
+ * An invalidation racing with the rebuild sets the flag again, so the next
+ * lookup enumerates once more.
+ */
+static int check_mbus_format(struct unicam_device *dev,
+			     const struct unicam_fmt *format)
 {
-	if (v4l2_fourcc == fmt->repacked_fourcc)
-		/* Repacking always goes to 16bpp */
-		return ALIGN(width << 1, BPL_ALIGNMENT);
-	else
-		return ALIGN((width * fmt->depth) >> 3, BPL_ALIGNMENT);
+	int ret;
+
+	mutex_lock(&dev->sensor_formats_lock);
+	if (atomic_xchg(&dev->sensor_formats_stale, 0))
+		unicam_cache_sensor_formats(dev);
+	ret = test_bit(format - formats, dev->sensor_formats);
+	mutex_unlock(&dev->sensor_formats_lock);
+
+	return ret;
 }
 
 static int __subdev_get_format(struct unicam_device *dev,
@@ -717,6 +913,61 @@ static int __subdev_get_format(struct unicam_device *dev,
 	return 0;
 }
 
+/* Whether fmt can be captured as pixelformat, as received or converted */
+static bool unicam_fmt_has_fourcc(const struct unicam_fmt *fmt, u32 pixelformat)
+{
+	return fmt->fourcc == pixelformat ||
+	       fmt->repacked_fourcc == pixelformat ||
+	       fmt->packed_fourcc == pixelformat;
+}
+
+static const struct unicam_fmt *find_format_by_pix(struct unicam_device *dev,
+						   u32 pixelformat)
+{
+	struct v4l2_mbus_framefmt mbus_fmt;
+	const struct unicam_fmt *fmt;
+	unsigned int i;
+
+	/*
+	 * Several bus formats can be captured as the same pixel format, e.g.
+	 * RAW10 and DPCM compressed RAW10 both as SBGGR10. Prefer the one the
+	 * sensor is currently set to.
+	 */
+	if (!__subdev_get_format(dev, &mbus_fmt, IMAGE_PAD)) {
+		fmt = find_format_by_code(mbus_fmt.code);
+		if (fmt && unicam_fmt_has_fourcc(fmt, pixelformat))
+			return fmt;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		if (unicam_fmt_has_fourcc(&formats[i], pixelformat)) {
+			if (formats[i].check_variants &&
+			    !check_mbus_format(dev, &formats[i]))
+				continue;
+			return &formats[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Bits per pixel written to memory when capturing fmt as v4l2_fourcc */
+static unsigned int output_depth(const struct unicam_fmt *fmt, u32 v4l2_fourcc)
+{
+	if (v4l2_fourcc == fmt->repacked_fourcc)
+		return 16;
+	if (v4l2_fourcc == fmt->packed_fourcc)
+		return fmt->packed_depth;
+	return fmt->depth;
+}
+
+static unsigned int bytes_per_line(u32 width, const struct unicam_fmt *fmt,
+				   u32 v4l2_fourcc)
+{
+	return ALIGN((width * output_depth(fmt, v4l2_fourcc)) >> 3,
+		     BPL_ALIGNMENT);
+}
+
 static int __subdev_set_format(struct unicam_device *dev,
 			       struct v4l2_mbus_framefmt *fmt, int pad_id)
 {
@@ -845,6 +1096,46 @@ static unsigned int unicam_get_lines_done(struct unicam_device *dev)
 	return (unsigned int)(cur_addr - start_addr) / stride;
 }
 
+static void unicam_ring_push(struct unicam_node *node,
+			     struct unicam_buffer *buf)
+{
+	unsigned int head = node->ring_head;
+
+	node->ring[head % VB2_MAX_FRAME] = buf;
+	/* Publish the entry before the head that makes it visible */
+	smp_store_release(&node->ring_head, head + 1);
+}
+
+static struct unicam_buffer *unicam_ring_pop(struct unicam_node *node)
+{
+	unsigned int tail = node->ring_tail;
+	struct unicam_buffer *buf;
+
+	/* Pairs with unicam_ring_push(), the entry is valid once seen */
+	if (smp_load_acquire(&node->ring_head) == tail)
+		return NULL;
+
+	buf = node->ring[tail % VB2_MAX_FRAME];
+	node->ring_tail = tail + 1;
+
+	return buf;
+}
+
+/* Buffers returned after a repeated FS go first, they were queued earlier */
+static struct unicam_buffer *unicam_next_queued(struct unicam_node *node)
+{
+	struct unicam_buffer *buf;
+
+	buf = list_first_entry_or_null(&node->requeue, struct unicam_buffer,
+				       list);
+	if (buf) {
+		list_del(&buf->list);
+		return buf;
+	}
+
+	return unicam_ring_pop(node);
+}
+
 static void unicam_schedule_next_buffer(struct unicam_node *node)
 {
 	struct unicam_device *dev = node->dev;
@@ -852,9 +1143,10 @@ static void unicam_schedule_next_buffer(struct unicam_node *node)
 	unsigned int size;
 	dma_addr_t addr;
 
-	buf = list_first_entry(&node->dma_queue, struct unicam_buffer, list);
+	buf = unicam_next_queued(node);
+	if (!buf)
+		return;
 	node->next_frm = buf;
-	list_del(&buf->list);
 
 	addr = vb2_dma_contig_plane_dma_addr(&buf->vb.vb2_buf, 0);
 	size = (node->pad_id == IMAGE_PAD) ?
@@ -881,32 +1173,149 @@ static void unicam_process_buffer_complete(struct unicam_node *node,
 	node->cur_frm->vb.field = node->m_fmt.field;
 	node->cur_frm->vb.sequence = sequence;
 
-	vb2_buffer_done(&node->cur_frm->vb.vb2_buf, VB2_BUF_STATE_DONE);
+	/* Handed to vb2 by unicam_isr_thread() */
+	llist_add(&node->cur_frm->done, &node->dev->done_list);
+}
+
+/* Queued to the video device by unicam_isr_thread() */
+static void unicam_defer_event(struct unicam_device *unicam,
+			       const struct v4l2_event *event)
+{
+	if (!kfifo_put(&unicam->events, *event))
+		unicam->stats.events_dropped++;
 }
 
-static void unicam_queue_event_sof(struct unicam_device *unicam)
+static void unicam_defer_event_sof(struct unicam_device *unicam)
 {
 	struct v4l2_event event = {
 		.type = V4L2_EVENT_FRAME_SYNC,
 		.u.frame_sync.frame_sequence = unicam->sequence,
 	};
 
-	v4l2_event_queue(&unicam->node[IMAGE_PAD].video_dev, &event);
+	unicam_defer_event(unicam, &event);
+}
+
+static bool unicam_defer_event_slice(struct unicam_device *unicam)
+{
+	struct unicam_buffer *frm = unicam->node[IMAGE_PAD].cur_frm;
+	struct v4l2_event event = {
+		.type = V4L2_EVENT_UNICAM_SLICE,
+	};
+	struct unicam_slice_event *slice = (void *)event.u.data;
+	unsigned int lines_done;
+
+	/* Nothing to report while writing to the dummy buffer */
+	if (!frm)
+		return false;
+
+	lines_done = unicam_get_lines_done(unicam);
+	if (!lines_done)
+		return false;
+
+	slice->sequence = unicam->sequence;
+	slice->lines_done = lines_done;
+	slice->buffer_index = frm->vb.vb2_buf.index;
+
+	unicam_defer_event(unicam, &event);
+
+	return true;
+}
+
+static void unicam_count_irq(struct unicam_device *unicam)
+{
+	struct unicam_stats *stats = &unicam->stats;
+	u64 now = ktime_get_ns();
+
+	stats->irqs++;
+
+	spin_lock(&stats->irq_window_lock);
+	stats->irq_window_count++;
+	if (now - stats->irq_window_start >= NSEC_PER_SEC) {
+		stats->irqs_per_sec = stats->irq_window_count;
+		stats->irq_window_count = 0;
+		stats->irq_window_start = now;
+	}
+	spin_unlock(&stats->irq_window_lock);
+}
+
+/* Start a new rate window when streaming starts, not at boot */
+static void unicam_reset_irq_rate(struct unicam_device *unicam)
+{
+	struct unicam_stats *stats = &unicam->stats;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats->irq_window_lock, flags);
+	stats->irqs_per_sec = 0;
+	stats->irq_window_count = 0;
+	stats->irq_window_start = ktime_get_ns();
+	spin_unlock_irqrestore(&stats->irq_window_lock, flags);
+}
+
+/*
+ * Interrupts over the last complete second when read. The handler only
+ * closes a window on the next interrupt, so once streaming stops the last
+ * window still has to be closed here, and one that ended over a second ago
+ * saw no interrupts.
+ */
+static u32 unicam_irqs_per_sec(struct unicam_stats *stats)
+{
+	unsigned long flags;
+	u64 elapsed;
+	u32 rate = 0;
+
+	spin_lock_irqsave(&stats->irq_window_lock, flags);
+	elapsed = ktime_get_ns() - stats->irq_window_start;
+	if (elapsed < NSEC_PER_SEC)
+		rate = stats->irqs_per_sec;
+	else if (elapsed < 2 * NSEC_PER_SEC)
+		rate = stats->irq_window_count;
+	spin_unlock_irqrestore(&stats->irq_window_lock, flags);
+
+	return rate;
+}
+
+static void unicam_count_latency(struct unicam_device *unicam, u64 ns)
+{
+	struct unicam_stats *stats = &unicam->stats;
+	unsigned int bucket = fls64(div_u64(ns, NSEC_PER_USEC));
+
+	stats->irq_latency[min(bucket, IRQ_LATENCY_BUCKETS - 1)]++;
+	if (ns > stats->irq_latency_max_ns)
+		stats->irq_latency_max_ns = min_t(u64, ns, U32_MAX);
+}
+
+static void unicam_count_errors(struct unicam_device *unicam, u32 sta)
+{
+	struct unicam_stats *stats = &unicam->stats;
+
+	if (sta & UNICAM_IFO)
+		stats->ifo++;
+	if (sta & UNICAM_OFO)
+		stats->ofo++;
+	if (sta & UNICAM_BFO)
+		stats->bfo++;
+	if (sta & UNICAM_CRCE)
+		stats->crce++;
+	if (sta & UNICAM_PLE)
+		stats->ple++;
+	if (sta & UNICAM_SSC)
+		stats->ssc++;
+	if (sta & UNICAM_HOE)
+		stats->hoe++;
 }
 
 /*
- * unicam_isr : ISR handler for unicam capture
- * @irq: irq number
- * @dev_id: dev_id ptr
+ * unicam_handle_irq : hard interrupt work for unicam capture
+ * @unicam: unicam device
  *
  * It changes status of the captured buffer, takes next buffer from the queue
- * and sets its address in unicam registers
+ * and sets its address in unicam registers. Completing buffers and queueing
+ * events is left to unicam_isr_thread().
  */
-static irqreturn_t unicam_isr(int irq, void *dev)
+static irqreturn_t unicam_handle_irq(struct unicam_device *unicam)
 {
-	struct unicam_device *unicam = dev;
-	unsigned int lines_done = unicam_get_lines_done(dev);
 	unsigned int sequence = unicam->sequence;
+	bool wake = false;
 	unsigned int i;
 	u32 ista, sta;
 	bool fe;
@@ -921,7 +1330,10 @@ static irqreturn_t unicam_isr(int irq, void *dev)
 	reg_write(unicam, UNICAM_ISTA, ista);
 
 	unicam_dbg(3, unicam, "ISR: ISTA: 0x%X, STA: 0x%X, sequence %d, lines done %d",
-		   ista, sta, sequence, lines_done);
+		   ista, sta, sequence, unicam_get_lines_done(unicam));
+
+	unicam_count_irq(unicam);
+	unicam_count_errors(unicam, sta);
 
 	if (!(sta & (UNICAM_IS | UNICAM_PI0)))
 		return IRQ_HANDLED;
@@ -970,10 +1382,12 @@ static irqreturn_t unicam_isr(int irq, void *dev)
 				 */
 				if (!node->cur_frm->vb.vb2_buf.timestamp) {
 					unicam_dbg(2, unicam, "ISR: FE without FS, dropping frame\n");
+					unicam->stats.fe_without_fs[i]++;
 					continue;
 				}
 
 				unicam_process_buffer_complete(node, sequence);
+				wake = true;
 				node->cur_frm = node->next_frm;
 				node->next_frm = NULL;
 				inc_seq = true;
@@ -1005,12 +1419,14 @@ static irqreturn_t unicam_isr(int irq, void *dev)
 			if (!unicam->node[i].streaming)
 				continue;
 
-			if (unicam->node[i].cur_frm)
+			if (unicam->node[i].cur_frm) {
 				unicam->node[i].cur_frm->vb.vb2_buf.timestamp =
 								ts;
-			else
+			} else {
 				unicam_dbg(2, unicam, "ISR: [%d] Dropping frame, buffer not available at FS\n",
 					   i);
+				unicam->stats.dummy_frames[i]++;
+			}
 			/*
 			 * Set the next frame output to go to a dummy frame
 			 * if no buffer currently queued.
@@ -1025,37 +1441,73 @@ static irqreturn_t unicam_isr(int irq, void *dev)
 				 * contain valid data. Return cur_frm to the
 				 * queue.
 				 */
-				spin_lock(&unicam->node[i].dma_queue_lock);
+				unicam->stats.repeated_fs[i]++;
 				list_add_tail(&unicam->node[i].cur_frm->list,
-					      &unicam->node[i].dma_queue);
-				spin_unlock(&unicam->node[i].dma_queue_lock);
+					      &unicam->node[i].requeue);
 				unicam->node[i].cur_frm = unicam->node[i].next_frm;
 				unicam->node[i].next_frm = NULL;
 			}
 		}
 
-		unicam_queue_event_sof(unicam);
+		unicam_defer_event_sof(unicam);
+		wake = true;
 		unicam->frame_started = true;
 	}
 
+	/* Report progress through the frame being written */
+	if (ista & UNICAM_LCI && !fe && unicam->slice_lines &&
+	    unicam->frame_started && unicam_defer_event_slice(unicam))
+		wake = true;
+
 	/*
 	 * Cannot swap buffer at frame end, there may be a race condition
 	 * where the HW does not actually swap it if the new frame has
-	 * already started.
+	 * already started. Without line count interrupts a frame start
+	 * coalesced with the previous frame end is the only chance to
+	 * schedule the next buffer. The new frame has started by then, so
+	 * the address is only used for the frame after it.
 	 */
-	if (ista & (UNICAM_FSI | UNICAM_LCI) && !fe) {
+	if ((ista & (UNICAM_FSI | UNICAM_LCI) && !fe) ||
+	    (ista & UNICAM_FSI && !unicam->line_int_freq)) {
 		for (i = 0; i < ARRAY_SIZE(unicam->node); i++) {
 			if (!unicam->node[i].streaming)
 				continue;
 
-			spin_lock(&unicam->node[i].dma_queue_lock);
-			if (!list_empty(&unicam->node[i].dma_queue) &&
-			    !unicam->node[i].next_frm)
+			if (!unicam->node[i].next_frm)
 				unicam_schedule_next_buffer(&unicam->node[i]);
-			spin_unlock(&unicam->node[i].dma_queue_lock);
 		}
 	}
 
+	return wake ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+static irqreturn_t unicam_isr(int irq, void *dev)
+{
+	struct unicam_device *unicam = dev;
+	u64 start = ktime_get_ns();
+	irqreturn_t ret;
+
+	ret = unicam_handle_irq(unicam);
+	unicam_count_latency(unicam, ktime_get_ns() - start);
+
+	return ret;
+}
+
+static irqreturn_t unicam_isr_thread(int irq, void *dev)
+{
+	struct unicam_device *unicam = dev;
+	struct unicam_buffer *buf, *tmp;
+	struct llist_node *done;
+	struct v4l2_event event;
+
+	while (kfifo_get(&unicam->events, &event))
+		v4l2_event_queue(&unicam->node[IMAGE_PAD].video_dev, &event);
+
+	/* Complete the buffers in the order they were captured */
+	done = llist_reverse_order(llist_del_all(&unicam->done_list));
+	llist_for_each_entry_safe(buf, tmp, done, done)
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+
 	return IRQ_HANDLED;
 }
 
@@ -1109,13 +1561,33 @@ static int unicam_log_status(struct file *file, void *fh)
 }
 
 /* V4L2 Video Centric IOCTLs */
+
+/*
+ * Whether one of the formats already enumerated can be captured as fourcc.
+ * A sensor offering both RAW10 and DPCM compressed RAW10 would otherwise
+ * list the unpacked and packed pixel formats twice.
+ */
+static bool unicam_fourcc_listed(const unsigned long *listed, u32 fourcc)
+{
+	unsigned int i;
+
+	for_each_set_bit(i, listed, ARRAY_SIZE(formats)) {
+		if (unicam_fmt_has_fourcc(&formats[i], fourcc))
+			return true;
+	}
+
+	return false;
+}
+
 static int unicam_enum_fmt_vid_cap(struct file *file, void  *priv,
 				   struct v4l2_fmtdesc *f)
 {
 	struct unicam_node *node = video_drvdata(file);
 	struct unicam_device *dev = node->dev;
+	DECLARE_BITMAP(listed, ARRAY_SIZE(formats)) = { 0 };
+	u32 fourccs[3];
 	unsigned int index = 0;
-	unsigned int i;
+	unsigned int i, j;
 	int ret = 0;
 
 	if (node->pad_id != IMAGE_PAD)
@@ -1139,22 +1611,25 @@ static int unicam_enum_fmt_vid_cap(struct file *file, void  *priv,
 		}
 
 		fmt = find_format_by_code(mbus_code.code);
-		if (fmt) {
-			if (fmt->fourcc) {
-				if (index == f->index) {
-					f->pixelformat = fmt->fourcc;
-					break;
-				}
-				index++;
-			}
-			if (fmt->repacked_fourcc) {
-				if (index == f->index) {
-					f->pixelformat = fmt->repacked_fourcc;
-					break;
-				}
-				index++;
+		if (!fmt)
+			continue;
+
+		fourccs[0] = fmt->fourcc;
+		fourccs[1] = fmt->repacked_fourcc;
+		fourccs[2] = fmt->packed_fourcc;
+
+		for (j = 0; j < ARRAY_SIZE(fourccs); j++) {
+			if (!fourccs[j] ||
+			    unicam_fourcc_listed(listed, fourccs[j]))
+				continue;
+			if (index == f->index) {
+				f->pixelformat = fourccs[j];
+				return 0;
 			}
+			index++;
 		}
+
+		__set_bit(fmt - formats, listed);
 	}
 
 	return 0;
@@ -1186,6 +1661,8 @@ static int unicam_g_fmt_vid_cap(struct file *file, void *priv,
 		return -EINVAL;
 
 	if (node->fmt != fmt) {
+		unicam_invalidate_sensor_formats(dev);
+
 		/*
 		 * The sensor format has changed so the pixelformat needs to
 		 * be updated. Try and retain the packed/unpacked choice if
@@ -1195,6 +1672,10 @@ static int unicam_g_fmt_vid_cap(struct file *file, void *priv,
 						node->v_fmt.fmt.pix.pixelformat)
 			/* Using the repacked format */
 			node->v_fmt.fmt.pix.pixelformat = fmt->repacked_fourcc;
+		else if (node->fmt->packed_fourcc ==
+			 node->v_fmt.fmt.pix.pixelformat && fmt->packed_fourcc)
+			/* Using the packed format */
+			node->v_fmt.fmt.pix.pixelformat = fmt->packed_fourcc;
 		else
 			/* Using the native format */
 			node->v_fmt.fmt.pix.pixelformat = fmt->fourcc;
@@ -1291,6 +1772,7 @@ static int unicam_try_fmt_vid_cap(struct file *file, void *priv,
 	v4l2_fill_pix_format(&f->fmt.pix, &sd_fmt.format);
 	if (mbus_fmt->code != fmt->code) {
 		/* Sensor has returned an alternate format */
+		unicam_invalidate_sensor_formats(dev);
 		fmt = find_format_by_code(mbus_fmt->code);
 		if (!fmt) {
 			/*
@@ -1777,6 +2259,8 @@ static int unicam_subscribe_event(struct v4l2_fh *fh,
 		return v4l2_event_subscribe(fh, sub, 2, NULL);
 	case V4L2_EVENT_SOURCE_CHANGE:
 		return v4l2_event_subscribe(fh, sub, 4, NULL);
+	case V4L2_EVENT_UNICAM_SLICE:
+		return v4l2_event_subscribe(fh, sub, 8, NULL);
 	}
 
 	return v4l2_ctrl_subscribe_event(fh, sub);
@@ -1786,9 +2270,12 @@ static void unicam_notify(struct v4l2_subdev *sd,
 			  unsigned int notification, void *arg)
 {
 	struct unicam_device *dev = to_unicam_device(sd->v4l2_dev);
+	const struct v4l2_event *event = arg;
 
 	switch (notification) {
 	case V4L2_DEVICE_NOTIFY_EVENT:
+		if (event->type == V4L2_EVENT_SOURCE_CHANGE)
+			unicam_invalidate_sensor_formats(dev);
 		v4l2_event_queue(&dev->node[IMAGE_PAD].video_dev, arg);
 		break;
 	default:
@@ -1871,7 +2358,12 @@ static int unicam_mc_enum_fmt_vid_cap(struct file *file, void  *priv,
 			}
 			j++;
 		}
-		if (formats[i].repacked_fourcc) {
+		/*
+		 * The decoded DPCM formats are listed by the uncompressed
+		 * formats they expand to.
+		 */
+		if (formats[i].repacked_fourcc &&
+		    (!formats[i].decode || f->mbus_code)) {
 			if (j == f->index) {
 				f->pixelformat = formats[i].repacked_fourcc;
 				f->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -1879,6 +2371,15 @@ static int unicam_mc_enum_fmt_vid_cap(struct file *file, void  *priv,
 			}
 			j++;
 		}
+		if (formats[i].packed_fourcc &&
+		    (!formats[i].decode || f->mbus_code)) {
+			if (j == f->index) {
+				f->pixelformat = formats[i].packed_fourcc;
+				f->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				return 0;
+			}
+			j++;
+		}
 	}
 
 	return -EINVAL;
@@ -2146,8 +2647,16 @@ static int unicam_mc_video_link_validate(struct media_link *link)
 		fmt = find_format_by_code(source_fmt.format.code);
 
 		if (!fmt || (fmt->fourcc != pix_fmt->pixelformat &&
-			     fmt->repacked_fourcc != pix_fmt->pixelformat))
+			     fmt->repacked_fourcc != pix_fmt->pixelformat &&
+			     fmt->packed_fourcc != pix_fmt->pixelformat))
 			return -EINVAL;
+
+		/*
+		 * Several bus formats expand to the same pixel format, so
+		 * follow the one the sensor sends when configuring the
+		 * receiver.
+		 */
+		node->fmt = fmt;
 	} else {
 		struct v4l2_meta_format *meta_fmt = &node->v_fmt.fmt.meta;
 
@@ -2230,24 +2739,22 @@ static void unicam_buffer_queue(struct vb2_buffer *vb)
 {
 	struct unicam_node *node = vb2_get_drv_priv(vb->vb2_queue);
 	struct unicam_buffer *buf = to_unicam_buffer(vb);
-	unsigned long flags;
 
-	spin_lock_irqsave(&node->dma_queue_lock, flags);
-	list_add_tail(&buf->list, &node->dma_queue);
-	spin_unlock_irqrestore(&node->dma_queue_lock, flags);
+	unicam_ring_push(node, buf);
 }
 
 static void unicam_set_packing_config(struct unicam_device *dev)
 {
-	u32 pack, unpack;
+	const struct unicam_fmt *fmt = dev->node[IMAGE_PAD].fmt;
+	u32 pixelformat = dev->node[IMAGE_PAD].v_fmt.fmt.pix.pixelformat;
+	u32 pack, unpack, decode = 0;
 	u32 val;
 
-	if (dev->node[IMAGE_PAD].v_fmt.fmt.pix.pixelformat ==
-	    dev->node[IMAGE_PAD].fmt->fourcc) {
+	if (pixelformat == fmt->fourcc) {
 		unpack = UNICAM_PUM_NONE;
 		pack = UNICAM_PPM_NONE;
 	} else {
-		switch (dev->node[IMAGE_PAD].fmt->depth) {
+		switch (fmt->depth) {
 		case 8:
 			unpack = UNICAM_PUM_UNPACK8;
 			break;
@@ -2268,26 +2775,84 @@ static void unicam_set_packing_config(struct unicam_device *dev)
 			break;
 		}
 
-		/* Repacking is always to 16bpp */
-		pack = UNICAM_PPM_PACK16;
+		switch (output_depth(fmt, pixelformat)) {
+		case 8:
+			pack = UNICAM_PPM_PACK8;
+			break;
+		case 10:
+			pack = UNICAM_PPM_PACK10;
+			break;
+		case 12:
+			pack = UNICAM_PPM_PACK12;
+			break;
+		case 14:
+			pack = UNICAM_PPM_PACK14;
+			break;
+		default:
+			pack = UNICAM_PPM_PACK16;
+			break;
+		}
+
+		/* Compressed data is decoded between unpacking and packing */
+		decode = fmt->decode;
 	}
 
 	val = 0;
 	set_field(&val, unpack, UNICAM_PUM_MASK);
+	set_field(&val, decode, UNICAM_DDM_MASK);
 	set_field(&val, pack, UNICAM_PPM_MASK);
 	reg_write(dev, UNICAM_IPIPE, val);
 }
 
+/*
+ * Pick the virtual channel and data type of the image from the sensor's
+ * frame descriptor. Sensors without one, or without CSI-2 entries, are
+ * captured on VC 0 with the data type of the configured format. Embedded
+ * data is taken by the receiver by its data type alone, so only the image
+ * stream is looked up.
+ */
+static void unicam_get_frame_desc(struct unicam_device *dev)
+{
+	struct unicam_node *image = &dev->node[IMAGE_PAD];
+	struct v4l2_mbus_frame_desc fd = { 0 };
+	unsigned int i;
+	int ret;
+
+	dev->image_vc = 0;
+	dev->image_dt = image->fmt->csi_dt;
+
+	if (dev->bus_type != V4L2_MBUS_CSI2_DPHY)
+		return;
+
+	ret = v4l2_subdev_call(dev->sensor, pad, get_frame_desc,
+			       image->src_pad_id, &fd);
+	if (ret < 0 || fd.type != V4L2_MBUS_FRAME_DESC_TYPE_CSI2)
+		return;
+
+	for (i = 0; i < fd.num_entries; i++) {
+		const struct v4l2_mbus_frame_desc_entry *entry = &fd.entry[i];
+
+		if (entry->pixelcode == MEDIA_BUS_FMT_SENSOR_DATA)
+			continue;
+
+		dev->image_vc = entry->bus.csi2.vc;
+		if (entry->bus.csi2.dt)
+			dev->image_dt = entry->bus.csi2.dt;
+		break;
+	}
+
+	unicam_dbg(2, dev, "image on VC %u DT 0x%02x\n", dev->image_vc,
+		   dev->image_dt);
+}
+
 static void unicam_cfg_image_id(struct unicam_device *dev)
 {
 	if (dev->bus_type == V4L2_MBUS_CSI2_DPHY) {
-		/* CSI2 mode, hardcode VC 0 for now. */
-		reg_write(dev, UNICAM_IDI0,
-			  (0 << 6) | dev->node[IMAGE_PAD].fmt->csi_dt);
+		/* CSI2 mode */
+		reg_write(dev, UNICAM_IDI0, (dev->image_vc << 6) | dev->image_dt);
 	} else {
 		/* CCP2 mode */
-		reg_write(dev, UNICAM_IDI0,
-			  0x80 | dev->node[IMAGE_PAD].fmt->csi_dt);
+		reg_write(dev, UNICAM_IDI0, 0x80 | dev->image_dt);
 	}
 }
 
@@ -2302,15 +2867,35 @@ static void unicam_enable_ed(struct unicam_device *dev)
 	reg_write(dev, UNICAM_DCS, val);
 }
 
+/* Lines between line count interrupts, 0 to disable them */
+static unsigned int unicam_line_int_freq(struct unicam_device *dev)
+{
+	unsigned int height = dev->node[IMAGE_PAD].v_fmt.fmt.pix.height;
+
+	/*
+	 * The line count interrupt repeats every line_int_freq lines, so in
+	 * slice mode it doubles as the slice event whatever the policy.
+	 */
+	if (dev->slice_lines)
+		return min_t(unsigned int, dev->slice_lines, MAX_LINE_INT_FREQ);
+
+	switch (lci_policy) {
+	case UNICAM_LCI_NONE:
+		return 0;
+	case UNICAM_LCI_MID:
+		return clamp_t(unsigned int, height >> 1, 1, MAX_LINE_INT_FREQ);
+	case UNICAM_LCI_DENSE:
+		return clamp_t(unsigned int, height >> 4, 16, MAX_LINE_INT_FREQ);
+	default:
+		return clamp_t(unsigned int, height >> 2, 128, MAX_LINE_INT_FREQ);
+	}
+}
+
 static void unicam_start_rx(struct unicam_device *dev, dma_addr_t *addr)
 {
-	int line_int_freq = dev->node[IMAGE_PAD].v_fmt.fmt.pix.height >> 2;
 	unsigned int size, i;
 	u32 val;
 
-	if (line_int_freq < 128)
-		line_int_freq = 128;
-
 	/* Enable lane clocks */
 	val = 1;
 	for (i = 0; i < dev->active_data_lanes; i++)
@@ -2366,7 +2951,8 @@ static void unicam_start_rx(struct unicam_device *dev, dma_addr_t *addr)
 	reg_write_field(dev, UNICAM_ANA, 0, UNICAM_DDL);
 
 	val = UNICAM_FSIE | UNICAM_FEIE | UNICAM_IBOB;
-	set_field(&val, line_int_freq, UNICAM_LCIE_MASK);
+	dev->line_int_freq = unicam_line_int_freq(dev);
+	set_field(&val, dev->line_int_freq, UNICAM_LCIE_MASK);
 	reg_write(dev, UNICAM_ICTL, val);
 	reg_write(dev, UNICAM_STA, UNICAM_STA_MASK_ALL);
 	reg_write(dev, UNICAM_ISTA, UNICAM_ISTA_MASK_ALL);
@@ -2389,7 +2975,7 @@ static void unicam_start_rx(struct unicam_device *dev, dma_addr_t *addr)
 	set_field(&val, 1, UNICAM_PCE);
 	set_field(&val, 1, UNICAM_GI);
 	set_field(&val, 1, UNICAM_CPH);
-	set_field(&val, 0, UNICAM_PCVC_MASK);
+	set_field(&val, dev->image_vc, UNICAM_PCVC_MASK);
 	set_field(&val, 1, UNICAM_PCDT_MASK);
 	reg_write(dev, UNICAM_CMP0, val);
 
@@ -2515,14 +3101,11 @@ static void unicam_disable(struct unicam_device *dev)
 static void unicam_return_buffers(struct unicam_node *node,
 				  enum vb2_buffer_state state)
 {
-	struct unicam_buffer *buf, *tmp;
-	unsigned long flags;
+	struct unicam_buffer *buf;
 
-	spin_lock_irqsave(&node->dma_queue_lock, flags);
-	list_for_each_entry_safe(buf, tmp, &node->dma_queue, list) {
-		list_del(&buf->list);
+	/* The interrupt handler no longer runs for this node */
+	while ((buf = unicam_next_queued(node)))
 		vb2_buffer_done(&buf->vb.vb2_buf, state);
-	}
 
 	if (node->cur_frm)
 		vb2_buffer_done(&node->cur_frm->vb.vb2_buf,
@@ -2533,7 +3116,6 @@ static void unicam_return_buffers(struct unicam_node *node,
 
 	node->cur_frm = NULL;
 	node->next_frm = NULL;
-	spin_unlock_irqrestore(&node->dma_queue_lock, flags);
 }
 
 static int unicam_start_streaming(struct vb2_queue *vq, unsigned int count)
@@ -2541,7 +3123,6 @@ static int unicam_start_streaming(struct vb2_queue *vq, unsigned int count)
 	struct unicam_node *node = vb2_get_drv_priv(vq);
 	struct unicam_device *dev = node->dev;
 	dma_addr_t buffer_addr[MAX_NODES] = { 0 };
-	unsigned long flags;
 	unsigned int i;
 	int ret;
 
@@ -2558,6 +3139,7 @@ static int unicam_start_streaming(struct vb2_queue *vq, unsigned int count)
 	}
 
 	dev->sequence = 0;
+	unicam_reset_irq_rate(dev);
 	ret = unicam_runtime_get(dev);
 	if (ret < 0) {
 		unicam_dbg(3, dev, "unicam_runtime_get failed\n");
@@ -2628,19 +3210,18 @@ static int unicam_start_streaming(struct vb2_queue *vq, unsigned int count)
 		if (!dev->node[i].streaming)
 			continue;
 
-		spin_lock_irqsave(&dev->node[i].dma_queue_lock, flags);
-		buf = list_first_entry(&dev->node[i].dma_queue,
-				       struct unicam_buffer, list);
+		buf = unicam_next_queued(&dev->node[i]);
 		dev->node[i].cur_frm = buf;
 		dev->node[i].next_frm = buf;
-		list_del(&buf->list);
-		spin_unlock_irqrestore(&dev->node[i].dma_queue_lock, flags);
 
 		buffer_addr[i] =
 			vb2_dma_contig_plane_dma_addr(&buf->vb.vb2_buf, 0);
 	}
 
+	unicam_get_frame_desc(dev);
+
 	dev->frame_started = false;
+	dev->slice_lines = v4l2_ctrl_g_ctrl(dev->slice_lines_ctrl);
 	unicam_start_rx(dev, buffer_addr);
 
 	ret = v4l2_subdev_call(dev->sensor, video, s_stream, 1);
@@ -2649,11 +3230,15 @@ static int unicam_start_streaming(struct vb2_queue *vq, unsigned int count)
 		goto err_disable_unicam;
 	}
 
+	/* The line count interrupt cannot be reprogrammed mid stream */
+	v4l2_ctrl_grab(dev->slice_lines_ctrl, true);
+
 	dev->clocks_enabled = true;
 	return 0;
 
 err_disable_unicam:
 	unicam_disable(dev);
+	synchronize_irq(dev->irq);
 	clk_disable_unprepare(dev->clock);
 err_vpu_clock:
 	if (clk_set_min_rate(dev->vpu_clock, 0))
@@ -2688,6 +3273,7 @@ static void unicam_stop_streaming(struct vb2_queue *vq)
 			unicam_err(dev, "stream off failed in subdev\n");
 
 		unicam_disable(dev);
+		v4l2_ctrl_grab(dev->slice_lines_ctrl, false);
 
 		media_pipeline_stop(node->video_dev.entity.pads);
 
@@ -2711,6 +3297,9 @@ static void unicam_stop_streaming(struct vb2_queue *vq)
 				   METADATA_PAD);
 	}
 
+	/* Let the interrupt thread complete the buffers already captured */
+	synchronize_irq(dev->irq);
+
 	/* Clear all queued buffers for the node */
 	unicam_return_buffers(node, VB2_BUF_STATE_ERROR);
 }
@@ -2797,6 +3386,17 @@ static const struct v4l2_file_operations unicam_fops = {
 	.mmap		= vb2_fop_mmap,
 };
 
+/* Only read at stream on, so it needs no s_ctrl */
+static const struct v4l2_ctrl_config unicam_ctrl_slice_lines = {
+	.id = V4L2_CID_UNICAM_SLICE_LINES,
+	.name = "Slice Event Lines",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = MAX_LINE_INT_FREQ,
+	.step = 1,
+	.def = 0,
+};
+
 static int
 unicam_async_bound(struct v4l2_async_notifier *notifier,
 		   struct v4l2_subdev *subdev,
@@ -2827,6 +3427,7 @@ static void unicam_release(struct kref *kref)
 	if (unicam->sensor_state)
 		__v4l2_subdev_state_free(unicam->sensor_state);
 
+	mutex_destroy(&unicam->sensor_formats_lock);
 	kfree(unicam);
 }
 
@@ -2976,7 +3577,6 @@ static int register_node(struct unicam_device *unicam, struct unicam_node *node,
 		node->video_dev.tvnorms |= tvnorms;
 	}
 
-	spin_lock_init(&node->dma_queue_lock);
 	mutex_init(&node->lock);
 
 	vdev = &node->video_dev;
@@ -3017,7 +3617,7 @@ static int register_node(struct unicam_device *unicam, struct unicam_node *node,
 		return ret;
 	}
 
-	INIT_LIST_HEAD(&node->dma_queue);
+	INIT_LIST_HEAD(&node->requeue);
 
 	vdev->release = unicam_node_release;
 	vdev->fops = &unicam_fops;
@@ -3172,6 +3772,10 @@ static int unicam_async_complete(struct v4l2_async_notifier *notifier)
 	if (!unicam->sensor_state)
 		return -ENOMEM;
 
+	mutex_lock(&unicam->sensor_formats_lock);
+	unicam_cache_sensor_formats(unicam);
+	mutex_unlock(&unicam->sensor_formats_lock);
+
 	for (i = 0; i < unicam->sensor->entity.num_pads; i++) {
 		if (unicam->sensor->entity.pads[i].flags & MEDIA_PAD_FL_SOURCE) {
 			if (source_pads < MAX_NODES) {
@@ -3357,6 +3961,47 @@ cleanup_exit:
 	return ret;
 }
 
+static int unicam_stats_show(struct seq_file *s, void *data)
+{
+	struct unicam_device *unicam = s->private;
+	struct unicam_stats *stats = &unicam->stats;
+	unsigned int i;
+
+	seq_printf(s, "fifo overflows: image %u output %u burst %u\n",
+		   stats->ifo, stats->ofo, stats->bfo);
+	seq_printf(s, "packet errors:  crc %u length %u sync %u header %u\n",
+		   stats->crce, stats->ple, stats->ssc, stats->hoe);
+	seq_printf(s, "interrupts:     %u total, %u in the last second\n",
+		   stats->irqs, unicam_irqs_per_sec(stats));
+	seq_printf(s, "events dropped: %u\n", stats->events_dropped);
+	seq_printf(s, "irq latency:    max %u ns\n", stats->irq_latency_max_ns);
+	for (i = 0; i < IRQ_LATENCY_BUCKETS; i++)
+		seq_printf(s, "  %s%5u us: %u\n",
+			   i == IRQ_LATENCY_BUCKETS - 1 ? ">=" : " <",
+			   i == IRQ_LATENCY_BUCKETS - 1 ? 1U << (i - 1) : 1U << i,
+			   stats->irq_latency[i]);
+
+	for (i = 0; i < ARRAY_SIZE(unicam->node); i++)
+		seq_printf(s, "%-8s dummy %u fe_without_fs %u repeated_fs %u\n",
+			   i == IMAGE_PAD ? "image" : "embedded",
+			   stats->dummy_frames[i], stats->fe_without_fs[i],
+			   stats->repeated_fs[i]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(unicam_stats);
+
+static void unicam_debugfs_init(struct unicam_device *unicam)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "%s-%s", UNICAM_MODULE_NAME,
+		 dev_name(&unicam->pdev->dev));
+	unicam->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("stats", 0444, unicam->debugfs, unicam,
+			    &unicam_stats_fops);
+}
+
 static int unicam_probe(struct platform_device *pdev)
 {
 	struct unicam_device *unicam;
@@ -3368,6 +4013,8 @@ static int unicam_probe(struct platform_device *pdev)
 
 	kref_init(&unicam->kref);
 	unicam->pdev = pdev;
+	mutex_init(&unicam->sensor_formats_lock);
+	spin_lock_init(&unicam->stats.irq_window_lock);
 
 	/*
 	 * Adopt the current setting of the module parameter, and check if
@@ -3412,8 +4059,13 @@ static int unicam_probe(struct platform_device *pdev)
 		goto err_unicam_put;
 	}
 
-	ret = devm_request_irq(&pdev->dev, ret, unicam_isr, 0,
-			       "unicam_capture0", unicam);
+	unicam->irq = ret;
+	init_llist_head(&unicam->done_list);
+	INIT_KFIFO(unicam->events);
+
+	ret = devm_request_threaded_irq(&pdev->dev, unicam->irq, unicam_isr,
+					unicam_isr_thread, 0, "unicam_capture0",
+					unicam);
 	if (ret) {
 		dev_err(&pdev->dev, "Unable to request interrupt\n");
 		ret = -EINVAL;
@@ -3451,6 +4103,14 @@ static int unicam_probe(struct platform_device *pdev)
 	if (ret < 0)
 		goto err_media_unregister;
 
+	unicam->slice_lines_ctrl = v4l2_ctrl_new_custom(&unicam->ctrl_handler,
+							&unicam_ctrl_slice_lines,
+							NULL);
+	if (unicam->ctrl_handler.error) {
+		ret = unicam->ctrl_handler.error;
+		goto err_media_unregister;
+	}
+
 	/* set the driver data in platform device */
 	platform_set_drvdata(pdev, unicam);
 
@@ -3463,6 +4123,8 @@ static int unicam_probe(struct platform_device *pdev)
 	/* Enable the block power domain */
 	pm_runtime_enable(&pdev->dev);
 
+	unicam_debugfs_init(unicam);
+
 	return 0;
 
 err_media_unregister:
@@ -3481,6 +4143,7 @@ static int unicam_remove(struct platform_device *pdev)
 
 	unicam_dbg(2, unicam, "%s\n", __func__);
 
+	debugfs_remove_recursive(unicam->debugfs);
 	v4l2_async_nf_unregister(&unicam->notifier);
 	v4l2_device_unregister(&unicam->v4l2_dev);
 	media_device_unregister(&unicam->mdev);
@@ -206,6 +206,19 @@
 		#define UNICAM_PUM_UNPACK14	6
 		#define UNICAM_PUM_UNPACK16	7
 #define UNICAM_DDM_MASK		GENMASK(6, 3)
+		/* DPCM decode modes */
+		#define UNICAM_DDM_NONE		0
+		#define UNICAM_DDM_8TO10	1
+		#define UNICAM_DDM_7TO10	2
+		#define UNICAM_DDM_6TO10	3
+		#define UNICAM_DDM_8TO12	4
+		#define UNICAM_DDM_7TO12	5
+		#define UNICAM_DDM_6TO12	6
+		#define UNICAM_DDM_10TO14	7
+		#define UNICAM_DDM_8TO14	8
+		#define UNICAM_DDM_12TO16	9
+		#define UNICAM_DDM_10TO16	10
+		#define UNICAM_DDM_8TO16	11
 #define UNICAM_PPM_MASK		GENMASK(9, 7)
 		/* Packing modes */
 		#define UNICAM_PPM_NONE		0
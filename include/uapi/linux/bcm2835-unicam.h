@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: ((GPL-2.0+ WITH Linux-syscall-note) OR BSD-3-Clause) */
+/*
+ * BCM283x / BCM271x Unicam capture driver
+ *
+ * Controls and events specific to the Unicam CSI-2 receiver.
+ */
+
+#ifndef __BCM2835_UNICAM_H__
+#define __BCM2835_UNICAM_H__
+
+#include <linux/types.h>
+#include <linux/v4l2-controls.h>
+#include <linux/videodev2.h>
+
+/*
+ * Base of the Unicam controls, a block of 16 above those reserved for other
+ * drivers in v4l2-controls.h.
+ */
+#define V4L2_CID_USER_UNICAM_BASE		(V4L2_CID_USER_BASE + 0x1f00)
+
+/*
+ * Lines between slice progress events on the image node, 0 to disable them.
+ * Read at stream on and locked while streaming.
+ */
+#define V4L2_CID_UNICAM_SLICE_LINES		(V4L2_CID_USER_UNICAM_BASE + 0)
+
+/*
+ * Private event queued on the image node every V4L2_CID_UNICAM_SLICE_LINES
+ * lines of a frame, letting userland start on the top of a frame before it is
+ * complete. The payload in v4l2_event.u.data is a struct unicam_slice_event.
+ */
+#define V4L2_EVENT_UNICAM_SLICE			(V4L2_EVENT_PRIVATE_START + 1)
+
+struct unicam_slice_event {
+	/* Sequence number the completed buffer will carry */
+	__u32 sequence;
+	/* Lines of the frame written to memory so far */
+	__u32 lines_done;
+	/* Index of the vb2 buffer being written */
+	__u32 buffer_index;
+};
+
+#endif /* __BCM2835_UNICAM_H__ */